@@ -1,38 +1,201 @@
 #include "DrawCall.h"
 
+size_t DrawCall::VertexHash::operator()(const Vertex &vertex) const {
+  // std::hash<float> maps -0 and +0 to the same value, which keeps this consistent with Vertex::operator==
+  hash<float> hasher;
+  const float *floats = &vertex.position.x;
+  size_t result = 0;
+  
+  for (int i = 0; i < sizeof(Vertex) / sizeof(float); i++) {
+    result ^= hasher(floats[i]) + 0x9e3779b9 + (result << 6) + (result >> 2);
+  }
+  
+  return result;
+}
+
 DrawCall::DrawCall(const vector<vec3> &positions) {
   vector<vec3> normals = createNormalsFromPositions(positions);
-  initCommon(positions, normals);
+  initCommon(positions, normals, {}, {});
 }
 
 DrawCall::DrawCall(const vector<vec3> &positions, const vector<vec3> &normals) {
-  initCommon(positions, normals);
+  initCommon(positions, normals, {}, {});
 }
 
 DrawCall::DrawCall(const vector<vec3> &positions, const vector<vec3> &normals, const vector<vec2> &texCoords) {
-  {
-    uint64_t dataSize = sizeof(texCoords[0]) * texCoords.size();
-    gfx::createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, dataSize, &texCoordBuffer, &texCoordBufferMemory);
+  if (normals.empty()) {
+    auto newNormals = createNormalsFromPositions(positions);
+    initCommon(positions, newNormals, texCoords, {});
+  } else initCommon(positions, normals, texCoords, {});
+}
+
+DrawCall::DrawCall(const vector<vec3> &positions, const vector<vec3> &normals, const vector<vec2> &texCoords, const vector<uint32_t> &indices) {
+  SDL_assert_release(!indices.empty());
+  initCommon(positions, normals, texCoords, indices);
+}
+
+DrawCall::DrawCall(const VertexBufferLayout &layout, const void *data) {
+  SDL_assert_release(layout.positionFormat == positionFormat);
+  createVertexBuffer(layout, data);
+}
+
+void DrawCall::initCommon(const vector<vec3> &positions, const vector<vec3> &normals, const vector<vec2> &texCoords, const vector<uint32_t> &indices) {
+  SDL_assert_release(positions.size() == normals.size());
+  SDL_assert_release(texCoords.empty() || texCoords.size() == positions.size());
+  
+  if (indices.empty()) {
+    
+    // Weld identical corners of the triangle list, then recurse with the indexed result
+    unordered_map<Vertex, uint32_t, VertexHash> uniqueVertices;
+    uniqueVertices.reserve(positions.size());
+    
+    vector<vec3> weldedPositions;
+    vector<vec3> weldedNormals;
+    vector<vec2> weldedTexCoords;
+    vector<uint32_t> weldedIndices;
+    weldedIndices.reserve(positions.size());
     
-    uint8_t *data = (uint8_t*)texCoords.data();
-    gfx::setBufferMemory(texCoordBufferMemory, dataSize, data);
+    for (uint32_t i = 0; i < positions.size(); i++) {
+      Vertex vertex = {positions[i], normals[i], texCoords.empty() ? vec2(0, 0) : texCoords[i]};
+      
+      auto inserted = uniqueVertices.insert({vertex, (uint32_t)weldedPositions.size()});
+      if (inserted.second) {
+        weldedPositions.push_back(vertex.position);
+        weldedNormals.push_back(vertex.normal);
+        if (!texCoords.empty()) weldedTexCoords.push_back(vertex.texCoord);
+      }
+      
+      weldedIndices.push_back(inserted.first->second);
+    }
+    
+    initCommon(weldedPositions, weldedNormals, weldedTexCoords, weldedIndices);
+    return;
   }
   
-  if (normals.empty()) {
-    auto newNormals = createNormalsFromPositions(positions);
-    initCommon(positions, newNormals);
-  } else initCommon(positions, normals);
+  VertexBufferLayout layout;
+  vector<uint8_t> data;
+  packVertexBuffer(positions, normals, texCoords, indices, &layout, &data);
+  createVertexBuffer(layout, data.data());
+}
+
+// Maps a unit vector onto the octahedron |x|+|y|+|z| = 1, then folds the lower hemisphere over the upper one so it fits in two components
+static vec2 encodeOctahedralNormal(vec3 normal) {
+  normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+  vec2 encoded = vec2(normal.x, normal.y);
+  
+  if (normal.z < 0) {
+    vec2 signs = vec2(encoded.x >= 0 ? 1 : -1, encoded.y >= 0 ? 1 : -1);
+    encoded = (1.0f - abs(vec2(encoded.y, encoded.x))) * signs;
+  }
+  
+  return encoded;
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void DrawCall::packVertexBuffer(const vector<vec3> &positions, const vector<vec3> &normals, const vector<vec2> &texCoords, const vector<uint32_t> &indices, VertexBufferLayout *layoutOut, vector<uint8_t> *dataOut) {
+  VertexBufferLayout &layout = *layoutOut;
+  layout.vertexCount = (uint32_t)positions.size();
+  layout.indexCount = (uint32_t)indices.size();
+  layout.positionFormat = positionFormat;
+  
+  // Bounding volumes. The sphere is centred on the box, which is loose but cheap.
+  vec3 minBound = positions[0];
+  vec3 maxBound = positions[0];
+  for (auto &position : positions) {
+    minBound = min(minBound, position);
+    maxBound = max(maxBound, position);
+  }
+  
+  vec3 centre = (minBound + maxBound) * 0.5f;
+  float radius = 0;
+  for (auto &position : positions) radius = std::max(radius, distance(centre, position));
+  
+  layout.boundsMin = vec4(minBound, 0);
+  layout.boundsMax = vec4(maxBound, 0);
+  layout.boundingSphere = vec4(centre, radius);
+  
+  // Stream 0: positions
+  vector<uint8_t> positionData;
+  
+  if (QUANTIZE_VERTEX_POSITIONS) {
+    
+    // Positions are stored relative to the centre of the bounds, normalized to [-1, 1] on each axis
+    vec3 halfExtent = max((maxBound - minBound) * 0.5f, vec3(1e-6f));
+    layout.positionScale = vec4(halfExtent, 0);
+    layout.positionOffset = vec4(centre, 0);
+    
+    vector<uint64_t> packedPositions;
+    packedPositions.reserve(positions.size());
+    for (auto &position : positions) {
+      packedPositions.push_back(packSnorm4x16(vec4((position - centre) / halfExtent, 1)));
+    }
+    
+    positionData.assign((uint8_t*)packedPositions.data(), (uint8_t*)(packedPositions.data() + packedPositions.size()));
+  } else {
+    layout.positionScale = vec4(1, 1, 1, 0);
+    layout.positionOffset = vec4(0, 0, 0, 0);
+    positionData.assign((uint8_t*)positions.data(), (uint8_t*)(positions.data() + positions.size()));
+  }
+  
+  // Stream 1: normals and texture coordinates, interleaved
+  struct PackedAttributes {
+    uint32_t normal;
+    uint32_t texCoord;
+  };
+  
+  static_assert(sizeof(PackedAttributes) == attributesSize, "attributesSize must match PackedAttributes");
+  
+  vector<PackedAttributes> attributes(positions.size());
+  for (int i = 0; i < positions.size(); i++) {
+    attributes[i].normal = packSnorm2x16(encodeOctahedralNormal(normals[i]));
+    attributes[i].texCoord = packHalf2x16(texCoords.empty() ? vec2(0, 0) : texCoords[i]);
+  }
+  
+  // Indices. 16-bit indices are used whenever the vertex count allows it.
+  vector<uint8_t> indexData;
+  
+  if (layout.vertexCount <= UINT16_MAX) {
+    layout.indexType = VK_INDEX_TYPE_UINT16;
+    
+    vector<uint16_t> shortIndices(indices.begin(), indices.end());
+    indexData.assign((uint8_t*)shortIndices.data(), (uint8_t*)(shortIndices.data() + shortIndices.size()));
+  } else {
+    layout.indexType = VK_INDEX_TYPE_UINT32;
+    indexData.assign((uint8_t*)indices.data(), (uint8_t*)(indices.data() + indices.size()));
+  }
+  
+  // Lay out the three regions in a single buffer
+  layout.attributesOffset = alignUp(positionData.size(), 4);
+  layout.indicesOffset = alignUp(layout.attributesOffset + sizeof(attributes[0]) * attributes.size(), 4);
+  layout.size = layout.indicesOffset + indexData.size();
+  
+  vector<uint8_t> &data = *dataOut;
+  data.assign(layout.size, 0);
+  memcpy(data.data(), positionData.data(), positionData.size());
+  memcpy(data.data() + layout.attributesOffset, attributes.data(), sizeof(attributes[0]) * attributes.size());
+  memcpy(data.data() + layout.indicesOffset, indexData.data(), indexData.size());
 }
 
-void DrawCall::initCommon(const vector<vec3> &positions, const vector<vec3> &normals) {
-  vertexCount = (uint32_t)positions.size();
-  gfx::createVec3Buffer(positions, &positionBuffer, &positionBufferMemory);
-  gfx::createVec3Buffer(normals, &normalBuffer, &normalBufferMemory);
+void DrawCall::createVertexBuffer(const VertexBufferLayout &layout, const void *data) {
+  vertexBufferLayout = layout;
+  descSetData.positionScale = layout.positionScale;
+  descSetData.positionOffset = layout.positionOffset;
+  
+  // Static geometry lives in device-local memory. The copy is queued, and happens at the next gfx::flushUploads().
+  gfx::createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, layout.size, &vertexBuffer, &vertexBufferMemory, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  gfx::uploadBufferData(vertexBuffer, 0, layout.size, data);
   
-  gfx::createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(descSetData), &descSetBuffer, &descSetBufferMemory);
-  descSet = gfx:: createDescSet(descSetBuffer);
+  descSet = gfx::getUniformRingDescSet(sizeof(descSetData));
   
-  printf("Created draw call with %i vertices\n", (int)positions.size());
+  printf("Created draw call with %i vertices, %i indices\n", (int)layout.vertexCount, (int)layout.indexCount);
+}
+
+vector<vector<VkFormat>> DrawCall::getVertexStreamFormats(bool positionsOnly) {
+  if (positionsOnly) return {{positionFormat}};
+  return {{positionFormat}, {normalFormat, texCoordFormat}};
 }
 
 vector<vec3> DrawCall::createNormalsFromPositions(const vector<vec3> &positions) {
@@ -59,31 +222,29 @@ vector<vec3> DrawCall::createNormalsFromPositions(const vector<vec3> &positions)
   return normals;
 }
 
+vec4 DrawCall::getWorldBoundingSphere() const {
+  const mat4 &world = descSetData.worldMatrix;
+  vec3 centre = vec3(world * vec4(vec3(vertexBufferLayout.boundingSphere), 1));
+  
+  // Non-uniform scales stretch the sphere most along the most scaled axis
+  float scaleSquared = std::max(std::max(dot(vec3(world[0]), vec3(world[0])), dot(vec3(world[1]), vec3(world[1]))), dot(vec3(world[2]), vec3(world[2])));
+  
+  return vec4(centre, vertexBufferLayout.boundingSphere.w * sqrtf(scaleSquared));
+}
+
 void DrawCall::addToCmdBuffer(VkCommandBuffer cmdBuffer, VkPipelineLayout layout) {
   
-  gfx::setBufferMemory(descSetBufferMemory, sizeof(descSetData), &descSetData);
-  vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descSet, 0, nullptr);
-  
-  if (texCoordBuffer == VK_NULL_HANDLE) {
-    const int bufferCount = 2;
-    VkBuffer buffers[bufferCount] = {
-      positionBuffer,
-      normalBuffer
-    };
-    VkDeviceSize offsets[bufferCount] = {0, 0};
-    vkCmdBindVertexBuffers(cmdBuffer, 0, bufferCount, buffers, offsets);
-  } else {
-    const int bufferCount = 3;
-    VkBuffer buffers[bufferCount] = {
-      positionBuffer,
-      normalBuffer,
-      texCoordBuffer
-    };
-    VkDeviceSize offsets[bufferCount] = {0, 0, 0};
-    vkCmdBindVertexBuffers(cmdBuffer, 0, bufferCount, buffers, offsets);
-  }
+  uint32_t descSetOffset = gfx::pushUniformData(sizeof(descSetData), &descSetData);
+  vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descSet, 1, &descSetOffset);
+  
+  // Pipelines that only declare the position stream ignore the second binding
+  const int bufferCount = 2;
+  VkBuffer buffers[bufferCount] = {vertexBuffer, vertexBuffer};
+  VkDeviceSize offsets[bufferCount] = {0, vertexBufferLayout.attributesOffset};
+  vkCmdBindVertexBuffers(cmdBuffer, 0, bufferCount, buffers, offsets);
   
-  vkCmdDraw(cmdBuffer, vertexCount, 1, 0, 0);
+  vkCmdBindIndexBuffer(cmdBuffer, vertexBuffer, vertexBufferLayout.indicesOffset, (VkIndexType)vertexBufferLayout.indexType);
+  vkCmdDrawIndexed(cmdBuffer, vertexBufferLayout.indexCount, 1, 0, 0, 0);
 }
 
 
@@ -1,13 +1,73 @@
 #pragma once
 #include "graphics.h"
 #include "linear_algebra.h"
+#include "settings.h"
+#include <unordered_map>
 
 class DrawCall {
 public:
+  // A vertex's full attribute tuple. Face corners with identical tuples are welded into a single indexed vertex.
+  struct Vertex {
+    vec3 position;
+    vec3 normal;
+    vec2 texCoord;
+    
+    bool operator==(const Vertex &other) const {
+      return position == other.position && normal == other.normal && texCoord == other.texCoord;
+    }
+  };
+  
+  struct VertexHash {
+    size_t operator()(const Vertex &vertex) const;
+  };
+  
+  // Vertex data lives in one buffer holding two streams. Stream 0 is positions alone, which is all the shadow pass binds. Stream 1 interleaves an octahedral normal with a half-float texture coordinate.
+  static constexpr VkFormat positionFormat = QUANTIZE_VERTEX_POSITIONS ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+  static constexpr VkFormat normalFormat   = VK_FORMAT_R16G16_SNORM;
+  static constexpr VkFormat texCoordFormat = VK_FORMAT_R16G16_SFLOAT;
+  
+  // Bytes per vertex in each stream
+  static constexpr uint32_t positionSize   = QUANTIZE_VERTEX_POSITIONS ? 8 : 12;
+  static constexpr uint32_t attributesSize = 8;
+  
+  // Vertex formats for gfx::createPipeline(). The attribute stream always includes texture coordinates, so pipelines that don't read them still get the right stride.
+  static vector<vector<VkFormat>> getVertexStreamFormats(bool positionsOnly);
+  
+  // Describes the contents of a packed vertex buffer (see packVertexBuffer()). It's plain data, so mesh cache files store it as it is.
+  struct VertexBufferLayout {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t indexType;      // VkIndexType
+    uint32_t positionFormat; // DrawCall::positionFormat at the time of packing
+    uint64_t attributesOffset;
+    uint64_t indicesOffset;
+    uint64_t size;
+    vec4 positionScale;
+    vec4 positionOffset;
+    
+    // Bounding volumes in mesh space
+    vec4 boundsMin;
+    vec4 boundsMax;
+    vec4 boundingSphere; // Centre in xyz, radius in w
+  };
+  
+  // Packs welded vertices and their indices into the position stream, attribute stream and index regions of a vertex buffer. Only touches the CPU, so it's safe to call from worker threads.
+  static void packVertexBuffer(
+    const vector<vec3> &positions,
+    const vector<vec3> &normals,
+    const vector<vec2> &texCoords,
+    const vector<uint32_t> &indices,
+    VertexBufferLayout *layoutOut,
+    vector<uint8_t> *dataOut);
+  
   // Descriptor set information
   struct {
     mat4 worldMatrix = glm::identity<mat4>();
     
+    // Set by the constructor. Quantized positions are scaled and offset back into mesh space by the vertex shader.
+    vec4 positionScale  = vec4(1, 1, 1, 0);
+    vec4 positionOffset = vec4(0, 0, 0, 0);
+    
     // Phong material defaults
     float diffuseReflectionConst = 0.5;
     float specReflectionConst    = 0.5;
@@ -29,33 +89,48 @@ public:
     const vector<vec3> &normals,
     const vector<vec2> &texCoords);
   
+  // Specify already-welded vertices and the triangle list indexing them. texCoords may be empty.
+  DrawCall(
+    const vector<vec3> &positions,
+    const vector<vec3> &normals,
+    const vector<vec2> &texCoords,
+    const vector<uint32_t> &indices);
+  
+  // Upload a vertex buffer packed earlier, e.g. one memory-mapped from a mesh cache file. data is only read during the constructor.
+  DrawCall(
+    const VertexBufferLayout &layout,
+    const void *data);
+  
   /// Submit rendering commands to a command buffer
   void addToCmdBuffer(
     VkCommandBuffer commandBuffer,
     VkPipelineLayout layout);
 
-private:
-  uint32_t vertexCount;
+  const VertexBufferLayout & getVertexBufferLayout() const { return vertexBufferLayout; }
   
-  // Per-vertex buffer handles
-  VkBuffer positionBuffer = VK_NULL_HANDLE;
-  VkDeviceMemory positionBufferMemory = VK_NULL_HANDLE;
-  
-  VkBuffer normalBuffer   = VK_NULL_HANDLE;
-  VkDeviceMemory normalBufferMemory   = VK_NULL_HANDLE;
+  // The mesh-space bounding sphere moved by the current world matrix (centre in xyz, radius in w)
+  vec4 getWorldBoundingSphere() const;
+
+private:
+  VertexBufferLayout vertexBufferLayout;
   
-  VkBuffer texCoordBuffer = VK_NULL_HANDLE;
-  VkDeviceMemory texCoordBufferMemory = VK_NULL_HANDLE;
+  // Position stream, attribute stream and indices, one after the other in a single allocation
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  gfx::MemoryAllocation vertexBufferMemory;
   
-  // Internal descriptor set handles
-  VkBuffer        descSetBuffer       = VK_NULL_HANDLE;
-  VkDeviceMemory  descSetBufferMemory = VK_NULL_HANDLE;
-  VkDescriptorSet descSet             = VK_NULL_HANDLE;
+  // Descriptor set for descSetData, which is copied into the uniform ring every time the draw call is recorded
+  VkDescriptorSet descSet = VK_NULL_HANDLE;
   
-  // Functionality shared by all constructors
+  // Functionality shared by all constructors. If indices is empty, the attributes are treated as a triangle list and welded first.
   void initCommon(
     const vector<vec3> &positions,
-    const vector<vec3> &normals);
+    const vector<vec3> &normals,
+    const vector<vec2> &texCoords,
+    const vector<uint32_t> &indices);
+  
+  void createVertexBuffer(
+    const VertexBufferLayout &layout,
+    const void *data);
   
   vector<vec3> createNormalsFromPositions(
     const vector<vec3> &positions);
@@ -1 +1,50 @@
-#include "ShadowMap.h"
\ No newline at end of file
+#include "ShadowMap.h"
+
+// 32-bit moments avoid most VSM precision artifacts, but linear filtering of them is optional.
+static VkFormat chooseMomentsFormat() {
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(gfx::physDevice, VK_FORMAT_R32G32_SFLOAT, &properties);
+  
+  VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  if ((properties.optimalTilingFeatures & requiredFeatures) == requiredFeatures) return VK_FORMAT_R32G32_SFLOAT;
+  
+  return VK_FORMAT_R16G16_SFLOAT;
+}
+
+ShadowMap::ShadowMap(uint32_t w, uint32_t h, uint32_t layerCount_) {
+  format = gfx::depthImageFormat;
+  
+  width = w;
+  height = h;
+  layerCount = layerCount_;
+  
+  gfx::createImage(format, width, height, &image, &imageMemory, VK_SAMPLE_COUNT_1_BIT, layerCount, VK_IMAGE_USAGE_SAMPLED_BIT);
+  arrayView = gfx::createImageView(image, format, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, layerCount);
+  
+  // The shadow render passes start and finish in SHADER_READ_ONLY_OPTIMAL, so layers that aren't rendered in a frame are still valid to sample.
+  gfx::transitionImageLayout(image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount, VK_IMAGE_ASPECT_DEPTH_BIT);
+  
+  compareSampler = gfx::createShadowSampler();
+  // Linear filtering of depth formats isn't guaranteed, and blocker depths shouldn't be blended anyway. Outside the shadowmap the depth reads as the far plane, like it does for compareSampler, so the PCSS blocker search finds no blockers there.
+  sampler = gfx::createSampler(VK_FILTER_NEAREST, VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE);
+  arraySamplerDescSet = gfx::createDescSet(arrayView, compareSampler);
+  arrayDepthDescSet = gfx::createDescSet(arrayView, sampler);
+  
+  for (uint32_t i = 0; i < layerCount; i++) {
+    layerViews.push_back(gfx::createImageView(image, format, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_VIEW_TYPE_2D, i, 1));
+    layerSamplerDescSets.push_back(gfx::createDescSet(layerViews[i], sampler));
+  }
+  
+  momentsFormat = chooseMomentsFormat();
+  gfx::createImage(momentsFormat, width, height, &momentsImage, &momentsImageMemory, VK_SAMPLE_COUNT_1_BIT, layerCount);
+  momentsArrayView = gfx::createImageView(momentsImage, momentsFormat, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, layerCount);
+  gfx::transitionImageLayout(momentsImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layerCount);
+  
+  for (uint32_t i = 0; i < layerCount; i++) {
+    momentsLayerViews.push_back(gfx::createImageView(momentsImage, momentsFormat, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, i, 1));
+  }
+  
+  // Outside the shadowmap the moments read as 1, which is what shadowMoments.frag writes where nothing was drawn, so everything there is lit.
+  momentsSampler = gfx::createSampler(VK_FILTER_LINEAR, VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE);
+  momentsDescSet = gfx::createDescSet(momentsArrayView, momentsSampler);
+}
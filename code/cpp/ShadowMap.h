@@ -2,32 +2,35 @@
 
 #include "graphics.h"
 
+// One layered depth image holds a shadow map for every light subsource, so the whole set can be rendered in a single multiview pass and sampled through one array view.
 class ShadowMap {
 public:
   VkFormat format;
   uint32_t width, height;
+  uint32_t layerCount;
   
   VkImage image;
-  VkDeviceMemory imageMemory;
-  VkImageView imageView;
-  VkImageView depthImageView;
+  gfx::MemoryAllocation imageMemory;
+  VkImageView arrayView;
+  vector<VkImageView> layerViews;
   
+  // The comparison sampler is used for lighting, through sampler2DArrayShadow. The plain sampler reads raw depth, for the PCSS blocker search and debug views.
+  VkSampler compareSampler;
   VkSampler sampler;
-  VkDescriptorSet samplerDescriptorSet;
+  VkDescriptorSet arraySamplerDescSet;
+  VkDescriptorSet arrayDepthDescSet;
+  vector<VkDescriptorSet> layerSamplerDescSets;
   
-  ShadowMap(uint32_t w, uint32_t h) {
-    format = VK_FORMAT_R16_SFLOAT;
-    
-    width = w;
-    height = h;
-    
-    gfx::createImage(format, width, height, &image, &imageMemory);
-    imageView = gfx::createImageView(image, format, VK_IMAGE_ASPECT_COLOR_BIT);
-    depthImageView = gfx::createDepthImageAndView(width, height);
-    
-    sampler = gfx::createSampler();
-    samplerDescriptorSet = gfx::createDescSet(imageView, sampler);
-  }
+  // Filterable moments of the depth layers, for the VSM and ESM filter modes. Written by shadowMoments.
+  VkFormat momentsFormat;
+  VkImage momentsImage;
+  gfx::MemoryAllocation momentsImageMemory;
+  VkImageView momentsArrayView;
+  vector<VkImageView> momentsLayerViews;
+  VkSampler momentsSampler;
+  VkDescriptorSet momentsDescSet;
+  
+  ShadowMap(uint32_t w, uint32_t h, uint32_t layerCount);
 };
 
 
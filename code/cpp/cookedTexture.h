@@ -0,0 +1,88 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <string>
+using namespace std;
+
+// Textures cooked offline by the texture cooker (code/tools/textureCooker.cpp) into block-compressed mip chains. The file layout follows KTX2: identifier, header, index, then one level index entry per mip level, with the level data stored smallest level first. There is no data format descriptor or key/value data, as vkFormat says all the loader needs.
+namespace cookedTexture {
+  const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+  
+  struct Header {
+    uint8_t  identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    
+    // Index
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+  };
+  
+  struct LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+  };
+  
+  static_assert(sizeof(Header) == 80, "Header must match the KTX2 layout");
+  static_assert(sizeof(LevelIndex) == 24, "LevelIndex must match the KTX2 layout");
+  
+  const uint32_t blockSize = 4; // All of the formats used are 4x4 texel blocks
+  
+  inline uint32_t getBytesPerBlock(VkFormat format) {
+    switch (format) {
+      case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return 8;
+      case VK_FORMAT_BC3_UNORM_BLOCK: return 16;
+      case VK_FORMAT_BC5_SNORM_BLOCK: return 16;
+      default: return 0; // Not a cooked format
+    }
+  }
+  
+  // The number of levels in a full mip chain, down to 1x1
+  inline uint32_t getFullLevelCount(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    uint32_t size = width > height ? width : height;
+    while (size > 1) {
+      size /= 2;
+      levels++;
+    }
+    
+    return levels;
+  }
+  
+  // Each level stores whole blocks, so partial blocks at the right and bottom edges are padded out
+  inline uint64_t getLevelByteLength(VkFormat format, uint32_t width, uint32_t height, uint32_t level) {
+    uint32_t levelWidth = width >> level > 0 ? width >> level : 1;
+    uint32_t levelHeight = height >> level > 0 ? height >> level : 1;
+    uint64_t blocksWide = (levelWidth + blockSize - 1) / blockSize;
+    uint64_t blocksHigh = (levelHeight + blockSize - 1) / blockSize;
+    return blocksWide * blocksHigh * getBytesPerBlock(format);
+  }
+  
+  // "floorboards.jpg" -> "floorboards.ktx2"
+  inline string getCookedPath(const char *imagePath) {
+    string path = imagePath;
+    size_t dot = path.find_last_of('.');
+    if (dot != string::npos) path.erase(dot);
+    return path + ".ktx2";
+  }
+  
+  // Converts an RGBA8 normal map texel in place into the signed layout the shaders read, the same way the JPEG loader always has. R becomes R - 127 (x). G and B both come from the source's blue channel: G becomes B / 2 - 127 (z) and B becomes B / 2 (the mesh's up axis). Shaders only read R and G and reconstruct the up axis, which lets cooked normal maps use two-channel BC5.
+  inline void convertNormalMapTexel(uint8_t *texel) {
+    uint8_t up = texel[2] / 2;
+    texel[0] = texel[0] - 127;
+    texel[1] = up - 127;
+    texel[2] = up;
+  }
+}
@@ -0,0 +1,122 @@
+#include "deferred.h"
+#include "settings.h"
+
+namespace deferred {
+  VkRenderPass gBufferRenderPass = VK_NULL_HANDLE;
+  bool supported = false;
+  
+  VkImage               albedoImage;
+  gfx::MemoryAllocation albedoImageMemory;
+  VkImageView           albedoImageView;
+  
+  VkImage               normalImage;
+  gfx::MemoryAllocation normalImageMemory;
+  VkImageView           normalImageView;
+  
+  VkFramebuffer         framebuffer;
+  VkSampler             sampler;
+  vector<VkDescriptorSet> descSets;
+  
+  static void createRenderPass() {
+    // The G-buffer colors aren't cleared, as the lighting pass skips any sample that no surface was drawn to (where depth is still at the far plane).
+    VkAttachmentDescription attachments[] = {
+      gfx::createAttachmentDescription(albedoFormat, false, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, MSAA_SETTING),
+      gfx::createAttachmentDescription(normalFormat, false, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, MSAA_SETTING),
+      gfx::createAttachmentDescription(gfx::depthImageFormat, true, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, MSAA_SETTING),
+    };
+    
+    VkAttachmentReference colorAttachmentRefs[2] = {};
+    colorAttachmentRefs[0].attachment = 0;
+    colorAttachmentRefs[0].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachmentRefs[1].attachment = 1;
+    colorAttachmentRefs[1].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 2; // Third, like in the main render pass, so gfx::cmdBeginRenderPass() clears it
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    
+    VkSubpassDescription subpassDesc = {};
+    subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDesc.colorAttachmentCount = 2;
+    subpassDesc.pColorAttachments = colorAttachmentRefs;
+    subpassDesc.pDepthStencilAttachment = &depthAttachmentRef;
+    
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpassDesc;
+    
+    // The second dependency makes the main render pass wait for the G-buffer before sampling it and testing against its depth.
+    VkSubpassDependency subpassDeps[2];
+    subpassDeps[0] = gfx::createSubpassDependency();
+    
+    subpassDeps[1] = {};
+    subpassDeps[1].srcSubpass = 0;
+    subpassDeps[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDeps[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpassDeps[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDeps[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    subpassDeps[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = subpassDeps;
+    
+    renderPassInfo.attachmentCount = 3;
+    renderPassInfo.pAttachments = attachments;
+    
+    auto result = vkCreateRenderPass(gfx::device, &renderPassInfo, nullptr, &gBufferRenderPass);
+    SDL_assert_release(result == VK_SUCCESS);
+  }
+  
+  // Whether the format can be rendered to and sampled at MSAA_SETTING samples, with the usage gfx::createImage() gives it
+  static bool isSampleableAttachment(VkFormat format) {
+    VkImageFormatProperties properties;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    auto result = vkGetPhysicalDeviceImageFormatProperties(gfx::physDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL, usage, 0, &properties);
+    return result == VK_SUCCESS && (properties.sampleCounts & MSAA_SETTING);
+  }
+  
+  void init() {
+    supported = gfx::depthImageSampleable && isSampleableAttachment(albedoFormat) && isSampleableAttachment(normalFormat);
+    if (!supported) {
+      printf("Deferred shading isn't supported with %ix MSAA on this device\n", (int)MSAA_SETTING);
+      settings.shadingPath = settings.FORWARD;
+      return;
+    }
+    
+    createRenderPass();
+    
+    auto extent = gfx::getSurfaceExtent();
+    
+    gfx::createImage(albedoFormat, extent.width, extent.height, &albedoImage, &albedoImageMemory, MSAA_SETTING);
+    albedoImageView = gfx::createImageView(albedoImage, albedoFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    
+    gfx::createImage(normalFormat, extent.width, extent.height, &normalImage, &normalImageMemory, MSAA_SETTING);
+    normalImageView = gfx::createImageView(normalImage, normalFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    
+    // The depth is shared with the main render pass, which loads it instead of clearing it when shading is deferred
+    framebuffer = gfx::createFramebuffer(gBufferRenderPass, {albedoImageView, normalImageView, gfx::depthImageView}, extent.width, extent.height);
+    
+    // Multisampled images can only be read with texelFetch(), which ignores the sampler
+    sampler = gfx::createSampler(VK_FILTER_NEAREST);
+    descSets = {
+      gfx::createDescSet(albedoImageView, sampler),
+      gfx::createDescSet(normalImageView, sampler),
+      gfx::createDescSet(gfx::depthImageView, sampler, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL),
+    };
+  }
+  
+  void cmdBeginGBufferPass(VkCommandBuffer cmdBuffer) {
+    auto extent = gfx::getSurfaceExtent();
+    
+    // Not used, as the color attachments aren't loaded or cleared
+    vec3 clearColor = {0, 0, 0};
+    
+    gfx::cmdBeginRenderPass(gBufferRenderPass, extent.width, extent.height, clearColor, framebuffer, cmdBuffer);
+  }
+  
+  vector<VkDescriptorSet> getGBufferDescSets() {
+    return descSets;
+  }
+}
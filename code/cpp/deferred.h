@@ -0,0 +1,15 @@
+#pragma once
+#include "graphics.h"
+
+// The G-buffer for deferred shading. The scene is drawn into it at MSAA_SETTING samples per pixel, then presentation lights it with a single fullscreen pass in gfx::deferredRenderPass, so the shadow filtering runs once per pixel however many surfaces overlap it.
+namespace deferred {
+  const VkFormat albedoFormat = VK_FORMAT_R8G8B8A8_UNORM; // Surface color, with the diffuse reflection constant in alpha
+  const VkFormat normalFormat = VK_FORMAT_R16G16B16A16_SFLOAT; // Octahedral view space normal, then the specular reflection constant and power
+  
+  extern VkRenderPass gBufferRenderPass;
+  extern bool supported; // Set by init(). Without it the G-buffer isn't created and the shading path stays forward.
+  
+  void init();
+  void cmdBeginGBufferPass(VkCommandBuffer cmdBuffer);
+  vector<VkDescriptorSet> getGBufferDescSets(); // Albedo, normal and depth, in that order
+}
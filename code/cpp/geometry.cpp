@@ -1,4 +1,6 @@
 #include "geometry.h"
+#include "meshCache.h"
+#include <algorithm>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
@@ -18,10 +20,42 @@ namespace geometry {
   
   VkDescriptorSet aeroplaneSamplerDescSet;
   
-  DrawCall * newDrawCallFromObjFile(const char *filePath) {
+  // Everything drawn in the shadow and main passes, and how the main pass shades it
+  struct SceneObject {
+    DrawCall *drawCall;
+    Shading shading;
+    uint32_t materialIndex;
+    vector<VkDescriptorSet> samplerDescSets;
+  };
+  
+  vector<SceneObject> sceneObjects;
+  
+  // An OBJ file's packed vertex buffer, ready to become a DrawCall. data points into either the mapped mesh cache file or packedData.
+  struct ObjMesh {
+    DrawCall::VertexBufferLayout layout;
+    const uint8_t *data = nullptr;
+    MappedFile cacheFile;
+    vector<uint8_t> packedData;
+  };
+  
+  // Only touches the CPU, so it's safe to call from worker threads. The OBJ is only parsed if its mesh cache file is missing or out of date.
+  void readObjFile(const char *filePath, ObjMesh *meshOut) {
+    MappedFile sourceFile;
+    SDL_assert_release(mapBinaryFile(filePath, &sourceFile));
+    uint64_t sourceHash = hashBytes(sourceFile.data, sourceFile.size);
+    unmapBinaryFile(&sourceFile);
+    
+    string cachePath = meshCache::getCachePath(filePath);
+    const DrawCall::VertexBufferLayout *cachedLayout;
+    if (meshCache::map(cachePath.c_str(), sourceHash, &meshOut->cacheFile, &cachedLayout, &meshOut->data)) {
+      meshOut->layout = *cachedLayout;
+      return;
+    }
+    
     vector<vec3> vertices;
     vector<vec3> normals;
     vector<vec2> texCoords;
+    vector<uint32_t> indices;
     
     tinyobj::attrib_t attributes;
     vector<tinyobj::shape_t> shapes;
@@ -33,6 +67,19 @@ namespace geometry {
     printf("OBJ file warnings: %s\n", warning.c_str());
     SDL_assert_release(ret);
     
+    // Every face corner may turn out to be a distinct vertex
+    size_t cornerCount = 0;
+    for (auto &shape : shapes) cornerCount += shape.mesh.indices.size();
+    
+    vertices.reserve(cornerCount);
+    normals.reserve(cornerCount);
+    texCoords.reserve(cornerCount);
+    indices.reserve(cornerCount);
+    
+    // Maps each distinct attribute tuple to its index, so that face corners sharing a tuple share a vertex
+    unordered_map<DrawCall::Vertex, uint32_t, DrawCall::VertexHash> uniqueVertices;
+    uniqueVertices.reserve(cornerCount);
+    
     // For each shape
     for (uint32_t s = 0; s < shapes.size(); s++) {
       uint32_t indexOffset = 0;
@@ -46,25 +93,33 @@ namespace geometry {
         for (uint32_t vertIndex = 0; vertIndex < faceVertCount; vertIndex++) {
           tinyobj::index_t idx = shapes[s].mesh.indices[indexOffset + vertIndex];
           
-          vec3 vertex = vec3(
+          DrawCall::Vertex vertex;
+          
+          vertex.position = vec3(
             attributes.vertices[3*idx.vertex_index],
             attributes.vertices[3*idx.vertex_index+1],
             attributes.vertices[3*idx.vertex_index+2]
             );
-          vertices.push_back(vertex);
           
-          vec3 normal = vec3(
+          vertex.normal = vec3(
             attributes.normals[3*idx.normal_index],
             attributes.normals[3*idx.normal_index+1],
             attributes.normals[3*idx.normal_index+2]
             );
-          normals.push_back(normal);
           
-          vec2 texCoord = vec2(
+          vertex.texCoord = vec2(
             attributes.texcoords[2*idx.texcoord_index],
             attributes.texcoords[2*idx.texcoord_index+1]
             );
-          texCoords.push_back(texCoord);
+          
+          auto inserted = uniqueVertices.insert({vertex, (uint32_t)vertices.size()});
+          if (inserted.second) {
+            vertices.push_back(vertex.position);
+            normals.push_back(vertex.normal);
+            texCoords.push_back(vertex.texCoord);
+          }
+          
+          indices.push_back(inserted.first->second);
         }
         
         indexOffset += faceVertCount;
@@ -73,7 +128,18 @@ namespace geometry {
     
     SDL_assert_release(vertices.size() == normals.size());
     
-    return new DrawCall(vertices, normals, texCoords);
+    printf("Welded %i face corners into %i vertices\n", (int)indices.size(), (int)vertices.size());
+    
+    DrawCall::packVertexBuffer(vertices, normals, texCoords, indices, &meshOut->layout, &meshOut->packedData);
+    meshOut->data = meshOut->packedData.data();
+    meshCache::write(cachePath.c_str(), sourceHash, meshOut->layout, meshOut->data);
+  }
+  
+  // The vertex data is copied into the staging buffer by the DrawCall constructor, after which the cache file can be unmapped
+  DrawCall * newDrawCallFromObjMesh(ObjMesh *mesh) {
+    DrawCall *drawCall = new DrawCall(mesh->layout, mesh->data);
+    unmapBinaryFile(&mesh->cacheFile);
+    return drawCall;
   }
   
   vector<vec3> createCuboidVertices(float width, float height, float yOffset) {
@@ -105,43 +171,53 @@ namespace geometry {
     return vertices;
   }
   
-  void addRingVertices(vec3 translation, int sideCount, float height, float btmRadius, float topRadius, vector<vec3> *verts) {
+  // Adds a row of sideCount vertices around the Y axis. The row wraps around, so there is no duplicated seam vertex.
+  void addRingVertices(float y, int sideCount, float radius, vector<vec3> *verts) {
     
     const vec3 normal = vec3(0, 1, 0);
     
     for (int i = 0; i < sideCount; i++) {
-      float angle0 = (i / (float)sideCount) * M_TAU;
-      float angle1 = ((i+1) / (float)sideCount) * M_TAU;
-      
-      vec3 vert00 = rotate(vec3(btmRadius, 0, 0), angle0, normal);
-      vec3 vert10 = rotate(vec3(btmRadius, 0, 0), angle1, normal);
-      vec3 vert01 = rotate(vec3(topRadius, height, 0), angle0, normal);
-      vec3 vert11 = rotate(vec3(topRadius, height, 0), angle1, normal);
+      float angle = (i / (float)sideCount) * M_TAU;
+      verts->push_back(rotate(vec3(radius, 0, 0), angle, normal) + vec3(0, y, 0));
+    }
+  }
+  
+  // Stitches two rows created by addRingVertices() together with two triangles per side. Triangles that would collapse onto a pole are left out.
+  void addRingIndices(uint32_t btmRowStart, uint32_t topRowStart, int sideCount, bool btmIsPole, bool topIsPole, vector<uint32_t> *indices) {
+    
+    for (int i = 0; i < sideCount; i++) {
+      uint32_t vert00 = btmRowStart + i;
+      uint32_t vert10 = btmRowStart + (i+1) % sideCount;
+      uint32_t vert01 = topRowStart + i;
+      uint32_t vert11 = topRowStart + (i+1) % sideCount;
       
-      verts->push_back(vert00 + translation);
-      verts->push_back(vert10 + translation);
-      verts->push_back(vert01 + translation);
+      if (!btmIsPole) {
+        indices->push_back(vert00);
+        indices->push_back(vert10);
+        indices->push_back(vert01);
+      }
       
-      verts->push_back(vert01 + translation);
-      verts->push_back(vert10 + translation);
-      verts->push_back(vert11 + translation);
+      if (!topIsPole) {
+        indices->push_back(vert01);
+        indices->push_back(vert10);
+        indices->push_back(vert11);
+      }
     }
   }
   
   DrawCall * newSphereDrawCall(int resolution, bool smoothNormals) {
     vector<vec3> verts;
+    vector<uint32_t> indices;
+    
+    const int sideCount = resolution*2;
+    
+    for (int i = 0; i <= resolution; i++) {
+      float verticalAngle = (i / (float)resolution) * M_PI;
+      addRingVertices(-cosf(verticalAngle), sideCount, sinf(verticalAngle), &verts);
+    }
     
     for (int i = 0; i < resolution; i++) {
-      float verticalAngle0 = (i / (float)resolution) * M_PI;
-      float verticalAngle1 = ((i+1) / (float)resolution) * M_PI;
-      
-      float btmRadius = sinf(verticalAngle0);
-      float topRadius = sinf(verticalAngle1);
-      
-      float btmY = -cosf(verticalAngle0);
-      float topY = -cosf(verticalAngle1);
-      
-      addRingVertices(vec3(0, btmY, 0), resolution*2, topY - btmY, btmRadius, topRadius, &verts);
+      addRingIndices(i * sideCount, (i+1) * sideCount, sideCount, i == 0, i == resolution-1, &indices);
     }
     
     if (smoothNormals) {
@@ -150,8 +226,15 @@ namespace geometry {
       vector<vec3> normals;
       for (auto &vert : verts) normals.push_back(vert);
       
-      return new DrawCall(verts, normals);
-    } else return new DrawCall(verts);
+      return new DrawCall(verts, normals, {}, indices);
+    } else {
+      
+      // Flat normals need a separate vertex per face corner
+      vector<vec3> triangleVerts;
+      for (auto index : indices) triangleVerts.push_back(verts[index]);
+      
+      return new DrawCall(triangleVerts);
+    }
   }
   
   void createFloor() {
@@ -170,8 +253,25 @@ namespace geometry {
   }
   
   void init() {
-    aeroplane = newDrawCallFromObjFile("aeroplane.obj");
-    frog = newDrawCallFromObjFile("Tree_frog.obj");
+    ObjMesh aeroplaneMesh;
+    ObjMesh frogMesh;
+    gfx::ImageFile floorImage;
+    gfx::ImageFile floorNormalsImage;
+    gfx::ImageFile frogImage;
+    gfx::ImageFile aeroplaneImage;
+    
+    // Parse and decode every asset file across all cores. Only the GPU resources below are created on this thread.
+    runInParallel({
+      [&]() { readObjFile("aeroplane.obj", &aeroplaneMesh); },
+      [&]() { readObjFile("Tree_frog.obj", &frogMesh); },
+      [&]() { gfx::readImageFile("floorboards.jpg", false, &floorImage); },
+      [&]() { gfx::readImageFile("floorboards_normals.jpg", true, &floorNormalsImage); },
+      [&]() { gfx::readImageFile("Tree_frog.jpg", false, &frogImage); },
+      [&]() { gfx::readImageFile("aeroplane.jpg", false, &aeroplaneImage); },
+    });
+    
+    aeroplane = newDrawCallFromObjMesh(&aeroplaneMesh);
+    frog = newDrawCallFromObjMesh(&frogMesh);
     
     createFloor();
     
@@ -224,9 +324,9 @@ namespace geometry {
     // Create floor texture sampler
     {
       VkImage image;
-      VkDeviceMemory imageMemory;
+      gfx::MemoryAllocation imageMemory;
       VkImageView imageView;
-      gfx::loadImage("floorboards.jpg", false, &image, &imageMemory, &imageView);
+      gfx::createImageFromFile(floorImage, &image, &imageMemory, &imageView);
       VkSampler sampler = gfx::createSampler();
       floorSamplerDescSet = gfx::createDescSet(imageView, sampler);
     }
@@ -234,9 +334,9 @@ namespace geometry {
     // Create floor normalmap sampler
     {
       VkImage image;
-      VkDeviceMemory imageMemory;
+      gfx::MemoryAllocation imageMemory;
       VkImageView imageView;
-      gfx::loadImage("floorboards_normals.jpg", true, &image, &imageMemory, &imageView);
+      gfx::createImageFromFile(floorNormalsImage, &image, &imageMemory, &imageView);
       VkSampler sampler = gfx::createSampler();
       floorNormalSamplerDescSet = gfx::createDescSet(imageView, sampler);
     }
@@ -244,9 +344,9 @@ namespace geometry {
     // Create frog texture sampler
     {
       VkImage image;
-      VkDeviceMemory imageMemory;
+      gfx::MemoryAllocation imageMemory;
       VkImageView imageView;
-      gfx::loadImage("Tree_frog.jpg", false, &image, &imageMemory, &imageView);
+      gfx::createImageFromFile(frogImage, &image, &imageMemory, &imageView);
       VkSampler sampler = gfx::createSampler();
       frogSamplerDescSet = gfx::createDescSet(imageView, sampler);
     }
@@ -254,38 +354,57 @@ namespace geometry {
     // Create aeroplane texture sampler
     {
       VkImage image;
-      VkDeviceMemory imageMemory;
+      gfx::MemoryAllocation imageMemory;
       VkImageView imageView;
-      gfx::loadImage("aeroplane.jpg", false, &image, &imageMemory, &imageView);
+      gfx::createImageFromFile(aeroplaneImage, &image, &imageMemory, &imageView);
       VkSampler sampler = gfx::createSampler();
       aeroplaneSamplerDescSet = gfx::createDescSet(imageView, sampler);
     }
+    
+    for (auto sphere : spheres) sceneObjects.push_back({sphere, BARE, 0, {}});
+    sceneObjects.push_back({floor, NORMAL_MAPPED, 1, {floorSamplerDescSet, floorNormalSamplerDescSet}});
+    sceneObjects.push_back({frog, TEXTURED, 2, {frogSamplerDescSet}});
+    sceneObjects.push_back({aeroplane, TEXTURED, 3, {aeroplaneSamplerDescSet}});
   }
   
-  void renderAllGeometryWithoutSamplers(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout) {
-    for (auto &sphere : spheres) sphere->addToCmdBuffer(cmdBuffer, pipelineLayout);
-    frog->addToCmdBuffer(cmdBuffer, pipelineLayout);
-    aeroplane->addToCmdBuffer(cmdBuffer, pipelineLayout);
-    floor->addToCmdBuffer(cmdBuffer, pipelineLayout);
+  static bool isInAnyFrustum(const DrawCall *drawCall, const vector<Frustum> &frusta) {
+    vec4 sphere = drawCall->getWorldBoundingSphere();
+    
+    for (auto &frustum : frusta) {
+      if (frustum.intersectsSphere(vec3(sphere), sphere.w)) return true;
+    }
+    
+    return false;
   }
   
-  void renderBareGeometry(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout) {
-    for (auto &sphere : spheres) sphere->addToCmdBuffer(cmdBuffer, pipelineLayout);
+  void renderAllGeometryWithoutSamplers(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout, const vector<Frustum> &frusta) {
+    for (auto &object : sceneObjects) {
+      if (isInAnyFrustum(object.drawCall, frusta)) object.drawCall->addToCmdBuffer(cmdBuffer, pipelineLayout);
+    }
   }
   
-  void renderTexturedGeometry(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout) {
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 18, 1, &frogSamplerDescSet, 0, nullptr);
-    frog->addToCmdBuffer(cmdBuffer, pipelineLayout);
+  vector<MainPassDraw> getMainPassDraws(const mat4 &view, const mat4 &proj) {
+    Frustum frustum(proj * view);
+    vector<MainPassDraw> draws;
     
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 18, 1, &aeroplaneSamplerDescSet, 0, nullptr);
-    aeroplane->addToCmdBuffer(cmdBuffer, pipelineLayout);
-  }
-  
-  void renderTexturedNormalMappedGeometry(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout) {
-    vector<VkDescriptorSet> floorDescSets = {floorSamplerDescSet, floorNormalSamplerDescSet};
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 18, (int)floorDescSets.size(), floorDescSets.data(), 0, nullptr);
+    for (auto &object : sceneObjects) {
+      vec4 sphere = object.drawCall->getWorldBoundingSphere();
+      if (!frustum.intersectsSphere(vec3(sphere), sphere.w)) continue;
+      
+      // The camera looks down its view space's -Z axis. Non-negative floats sort the same as their bit patterns.
+      float distance = std::max(-(view * vec4(vec3(sphere), 1)).z, 0.0f);
+      
+      MainPassDraw draw;
+      draw.sortKey = (uint64_t)object.shading << 56 | (uint64_t)object.materialIndex << 32 | floatBitsToUint(distance);
+      draw.drawCall = object.drawCall;
+      draw.shading = object.shading;
+      draw.materialIndex = object.materialIndex;
+      draw.samplerDescSets = &object.samplerDescSets;
+      draws.push_back(draw);
+    }
     
-    floor->addToCmdBuffer(cmdBuffer, pipelineLayout);
+    sort(draws.begin(), draws.end(), [](const MainPassDraw &a, const MainPassDraw &b) { return a.sortKey < b.sortKey; });
+    return draws;
   }
 }
 
@@ -3,10 +3,24 @@
 #include "DrawCall.h"
 
 namespace geometry {
-  void renderAllGeometryWithoutSamplers(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout);
-  void renderBareGeometry(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout);
-  void renderTexturedGeometry(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout);
-  void renderTexturedNormalMappedGeometry(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout);
+  // Picks the main pass pipeline. Also the order the main pass draws in.
+  enum Shading {
+    BARE,          // lit
+    NORMAL_MAPPED, // litTextured with a normal map
+    TEXTURED,      // litTextured without one
+  };
+  
+  // A draw in the main pass. samplerDescSets are bound from set 7 on, and are shared by every draw with the same materialIndex.
+  struct MainPassDraw {
+    uint64_t sortKey; // Shading, then material, then distance from the camera
+    DrawCall *drawCall;
+    Shading shading;
+    uint32_t materialIndex;
+    const vector<VkDescriptorSet> *samplerDescSets;
+  };
+  
+  void renderAllGeometryWithoutSamplers(VkCommandBuffer cmdBuffer, VkPipelineLayout pipelineLayout, const vector<Frustum> &frusta); // Skips draw calls outside all of the frusta
+  vector<MainPassDraw> getMainPassDraws(const mat4 &view, const mat4 &proj); // Culled to the camera's frustum and sorted by sortKey
   void init();
   DrawCall * newSphereDrawCall(int resolution, bool smoothNormals);
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <SDL2/SDL_vulkan.h>
 #include <vector>
 #include "linear_algebra.h"
+#include "settings.h"
 using namespace std;
 
 namespace gfx {
@@ -13,17 +14,88 @@ namespace gfx {
   const VkFormat depthImageFormat         = VK_FORMAT_D32_SFLOAT;
   const vector<const char *> requiredDeviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
   const int swapchainSize = 2;
+  const char * const pipelineCacheFilePath = "pipeline.cache";
+  const uint32_t pipelineCacheFileMagic = 0x48435050; // "PPCH"
   
   struct SwapchainFrame {
     VkImageView msaaView = VK_NULL_HANDLE;
     VkImageView resolvedView = VK_NULL_HANDLE;
     VkFramebuffer framebuffer = VK_NULL_HANDLE;
-    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VkFence lastUserFence = VK_NULL_HANDLE; // Fence of the frame in flight that last rendered to this image
     uint32_t index;
   };
   
+  // Everything owned by one of the FRAMES_IN_FLIGHT frames, so that the CPU can record a frame while the GPU is still executing the previous ones.
+  struct FrameInFlight {
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+    VkSemaphore renderCompletedSemaphore = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE; // Signalled when the GPU has finished executing cmdBuffer
+    uint32_t index; // Also selects this frame's segment of the uniform ring
+  };
+  
+  // A sub-range of a larger VkDeviceMemory block (see graphics_memory.cpp)
+  struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint8_t *mapped = nullptr; // Non-null for host-visible memory
+    
+    uint32_t memoryType = 0;
+    uint32_t blockIndex = 0;
+    bool linear = true;
+  };
+  
+  struct MemoryStats {
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    uint32_t freeRangeCount = 0;
+    VkDeviceSize bytesReserved = 0;
+    VkDeviceSize bytesUsed = 0;
+    VkDeviceSize largestFreeRange = 0;
+    float fragmentation = 0;
+  };
+  
+  // The CPU side of loadImage(): an image file read and decoded into memory by readImageFile(), which is safe to call from worker threads. createImageFromFile() turns it into a sampled image on the main thread.
+  struct ImageFile {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    bool cooked; // bytes holds a whole cooked texture file rather than RGBA8 texels
+    vector<uint8_t> bytes;
+  };
+  
+  // Arguments for createPipeline(), so that several pipelines can be described up front and created together by createPipelines()
+  struct PipelineDesc {
+    VkPipelineLayout layout;
+    vector<vector<VkFormat>> vertexAttribFormats;
+    VkExtent2D extent;
+    VkRenderPass renderPass;
+    VkCullModeFlags cullMode;
+    const char *vertexShaderPath;
+    const char *fragmentShaderPath; // Null for a depth-only pipeline
+    VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT;
+    const VkSpecializationInfo *specializationInfo = nullptr; // Applied to every stage. Stages ignore constants they don't declare.
+    VkBool32 depthWrite = VK_TRUE;
+    VkCompareOp depthCompareOp = VK_COMPARE_OP_LESS; // Lower depth values mean closer to 'camera'
+    uint32_t colorAttachmentCount = 1; // Must match the subpass
+    bool keepColorAttachment = false; // Depth-only pipelines have no color attachment unless this is set, for one in a subpass that has one (such as a depth pre-pass). Writes to it are masked off.
+    VkBool32 blendEnable = VK_FALSE; // Standard alpha blending with the attachment's existing color
+  };
+  
+  // Written ahead of the pipeline cache data on disk. Vulkan rejects cache data from other devices itself, but checking up front also catches driver updates and truncated files.
+  struct PipelineCacheFileHeader {
+    uint32_t magic;
+    uint32_t dataSize;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+  };
+  
   extern VkSwapchainKHR swapchain;
   extern SwapchainFrame swapchainFrames[swapchainSize];
+  extern FrameInFlight framesInFlight[FRAMES_IN_FLIGHT];
   
   extern VkInstance               instance;
   extern VkDebugUtilsMessengerEXT debugMsgr;
@@ -32,30 +104,42 @@ namespace gfx {
   extern VkDevice                 device;
   extern VkDescriptorPool         descriptorPool;
   extern VkDescriptorSetLayout    bufferDescLayout;
+  extern VkDescriptorSetLayout    dynamicBufferDescLayout;
   extern VkDescriptorSetLayout    samplerDescLayout;
   extern VkRenderPass             renderPass;
+  extern VkRenderPass             deferredRenderPass; // Compatible with renderPass, but loads the depth that the G-buffer pass left and keeps it read only, so that it can be sampled at the same time
   extern VkQueue                  queue;
   extern int                      queueFamilyIndex;
   extern VkCommandPool            commandPool;
+  extern VkPipelineCache          pipelineCache;
+  extern bool                     pipelineCacheWasLoaded;
   extern VkImageView              depthImageView;
+  extern bool                     depthImageSampleable; // Whether depthImageView can be read by shaders
+  extern bool                     multiviewEnabled;
+  extern bool                     textureCompressionBCEnabled;
   
   // creators (graphics_create.cpp)
   void createCoreHandles(SDL_Window *window);
-  void createBuffer(VkBufferUsageFlags usage, uint64_t dataSize, VkBuffer *bufferOut, VkDeviceMemory *memoryOut);
-  void createVec3Buffer(const vector<vec3> &vec3s, VkBuffer *bufferOut, VkDeviceMemory *memoryOut);
+  void createPipelineCache(); // Seeded from pipelineCacheFilePath if it was saved on this device and driver
+  void createBuffer(VkBufferUsageFlags usage, uint64_t dataSize, VkBuffer *bufferOut, MemoryAllocation *memoryOut, VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  void createVec3Buffer(const vector<vec3> &vec3s, VkBuffer *bufferOut, MemoryAllocation *memoryOut);
   VkFramebuffer createFramebuffer(VkRenderPass renderPass, vector<VkImageView> attachments, uint32_t width, uint32_t height);
-  void createColorImage(uint32_t width, uint32_t height, VkImage *imageOut, VkDeviceMemory *memoryOut);
-  void createImage(VkFormat format, uint32_t width, uint32_t height, VkImage *imageOut, VkDeviceMemory *memoryOut, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT);
-  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectMask);
-  VkImageView createDepthImageAndView(uint32 width, uint32_t height, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT);
-  VkSampler createSampler();
+  void createColorImage(uint32_t width, uint32_t height, VkImage *imageOut, MemoryAllocation *memoryOut);
+  void createImage(VkFormat format, uint32_t width, uint32_t height, VkImage *imageOut, MemoryAllocation *memoryOut, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT, uint32_t layerCount = 1, VkImageUsageFlags extraUsage = 0, uint32_t mipLevels = 1);
+  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectMask, VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D, uint32_t baseLayer = 0, uint32_t layerCount = 1, uint32_t mipLevels = 1);
+  VkImageView createDepthImageAndView(uint32 width, uint32_t height, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT, VkImageUsageFlags extraUsage = 0);
+  VkSampler createSampler(VkFilter filter = VK_FILTER_LINEAR, VkBorderColor borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK);
+  VkSampler createShadowSampler();
   VkCommandBuffer createCommandBuffer();
   VkPipelineLayout createPipelineLayout(VkDescriptorSetLayout descriptorSetLayouts[], uint32_t descriptorSetLayoutCount, uint32_t pushConstantSize);
-  VkPipelineVertexInputStateCreateInfo allocVertexInputInfo(const vector<VkFormat> &attribFormats);
+  VkPipelineVertexInputStateCreateInfo allocVertexInputInfo(const vector<vector<VkFormat>> &bindingAttribFormats); // One list of interleaved attribute formats per binding
   void freeVertexInputInfo(VkPipelineVertexInputStateCreateInfo info);
-  VkPipeline createPipeline(VkPipelineLayout layout, const vector<VkFormat> &vertexAttribFormats, VkExtent2D extent, VkRenderPass renderPass, VkCullModeFlags cullMode, const char *vertexShaderPath, const char *fragmentShaderPath, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT);  
+  VkPipeline createPipeline(VkPipelineLayout layout, const vector<vector<VkFormat>> &vertexAttribFormats, VkExtent2D extent, VkRenderPass renderPass, VkCullModeFlags cullMode, const char *vertexShaderPath, const char *fragmentShaderPath, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT, const VkSpecializationInfo *specializationInfo = nullptr);  
+  vector<VkPipeline> createPipelines(const vector<PipelineDesc> &descs); // Compiled in parallel batches on worker threads
+  VkShaderModule getShaderModule(const char *spirVFilePath); // Loaded once and shared by every pipeline that uses it. Main thread only.
   VkDescriptorSet createDescSet(VkBuffer buffer);
-  VkDescriptorSet createDescSet(VkImageView imageView, VkSampler sampler);
+  VkDescriptorSet createDynamicDescSet(VkBuffer buffer, uint64_t range);
+  VkDescriptorSet createDescSet(VkImageView imageView, VkSampler sampler, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
   VkAttachmentDescription createAttachmentDescription(VkFormat format, bool clear, VkAttachmentStoreOp storeOp, VkImageLayout finalLayout, VkSampleCountFlagBits sampleCountFlag = VK_SAMPLE_COUNT_1_BIT);
   VkSubpassDependency createSubpassDependency();
     
@@ -65,17 +149,42 @@ namespace gfx {
   VkExtent2D          getSurfaceExtent();
   VkPhysicalDevice    getPhysicalDevice();
   uint32_t            getMemoryType(uint32_t memTypeBits, VkMemoryPropertyFlags properties);
+  uint32_t            getMipLevelCount(VkFormat format, uint32_t width, uint32_t height);
   vector<VkImage>     getSwapchainImages();
-  SwapchainFrame*     getNextFrame(VkSemaphore imageAvailableSemaphore);
+  FrameInFlight*      getNextFrameInFlight();
+  SwapchainFrame*     getNextFrame(FrameInFlight *frameInFlight);
   
   // miscellaneous (graphics_misc.cpp)
-  void setBufferMemory(VkDeviceMemory memory, uint64_t dataSize, const void *data);
-  void setImageMemoryRGBA(VkImage image, VkDeviceMemory memory, uint32_t width, uint32_t height, const uint8_t *data);
+  void setBufferMemory(const MemoryAllocation &memory, uint64_t dataSize, const void *data);
+  void setImageMemoryRGBA(VkImage image, uint32_t width, uint32_t height, const uint8_t *data, uint32_t mipLevels = 1);
+  void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount = 1, VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT);
   void beginCommandBuffer(VkCommandBuffer cmdBuffer);
   void submitCommandBuffer(VkCommandBuffer cmdBuffer, VkSemaphore optionalWaitSemaphore = VK_NULL_HANDLE, VkPipelineStageFlags optionalWaitStage = 0, VkSemaphore optionalSignalSemaphore = VK_NULL_HANDLE, VkFence optionalFence = VK_NULL_HANDLE);
   void presentFrame(const SwapchainFrame *frame, VkSemaphore waitSemaphore);
   void cmdBeginRenderPass(VkRenderPass renderPass, uint32_t width, uint32_t height, vec3 clearColor, VkFramebuffer framebuffer, VkCommandBuffer cmdBuffer);
-  void loadImage(const char *filePath, bool normalMap, VkImage *imageOut, VkDeviceMemory *memoryOut, VkImageView *viewOut);
+  void cmdBeginDepthOnlyRenderPass(VkRenderPass renderPass, uint32_t width, uint32_t height, VkFramebuffer framebuffer, VkCommandBuffer cmdBuffer);
+  void loadImage(const char *filePath, bool normalMap, VkImage *imageOut, MemoryAllocation *memoryOut, VkImageView *viewOut);
+  void savePipelineCache();
+  void readImageFile(const char *filePath, bool normalMap, ImageFile *imageFileOut);
+  void createImageFromFile(const ImageFile &imageFile, VkImage *imageOut, MemoryAllocation *memoryOut, VkImageView *viewOut);
+  
+  // device memory arena (graphics_memory.cpp)
+  MemoryAllocation allocateMemory(VkMemoryRequirements reqs, VkMemoryPropertyFlags properties, bool linear);
+  void freeMemory(MemoryAllocation *allocation);
+  MemoryStats getMemoryStats();
+  void printMemoryStats();
+  
+  // per-frame uniform ring buffer (graphics_memory.cpp)
+  void            createUniformRing();
+  void            beginUniformFrame(uint32_t frameIndex);
+  uint32_t        pushUniformData(uint64_t dataSize, const void *data);
+  VkDescriptorSet getUniformRingDescSet(uint64_t range);
+  
+  // staging upload queue for device-local buffers and images (graphics_memory.cpp)
+  void uploadBufferData(VkBuffer dstBuffer, VkDeviceSize dstOffset, uint64_t dataSize, const void *data);
+  void uploadImageData(VkImage dstImage, uint32_t width, uint32_t height, uint32_t bytesPerPixel, const void *data, uint32_t mipLevels = 1); // Fills the top mip level and blits the rest. The image is left in SHADER_READ_ONLY_OPTIMAL.
+  void uploadCompressedImageLevel(VkImage dstImage, uint32_t mipLevel, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t blockSize, uint32_t bytesPerBlock, const void *data); // Levels must be queued in order, starting from 0
+  void flushUploads();
 }
 
 
@@ -1,5 +1,8 @@
 #include "graphics.h"
 #include "settings.h"
+#include <unordered_map>
+#include <string>
+#include <thread>
 
 namespace gfx {
   
@@ -11,14 +14,23 @@ namespace gfx {
   VkDescriptorPool         descriptorPool    = VK_NULL_HANDLE;
   VkDescriptorSetLayout    bufferDescLayout  = VK_NULL_HANDLE;
   VkDescriptorSetLayout    samplerDescLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout    dynamicBufferDescLayout = VK_NULL_HANDLE;
   VkRenderPass             renderPass        = VK_NULL_HANDLE;
+  VkRenderPass             deferredRenderPass = VK_NULL_HANDLE;
   VkQueue                  queue             = VK_NULL_HANDLE;
   int                      queueFamilyIndex  = -1;
   VkCommandPool            commandPool       = VK_NULL_HANDLE;
+  VkPipelineCache          pipelineCache     = VK_NULL_HANDLE;
+  bool                     pipelineCacheWasLoaded = false;
   VkImageView              depthImageView    = VK_NULL_HANDLE;
+  bool                     depthImageSampleable = false;
+  uint32_t                 instanceVersion   = VK_API_VERSION_1_0;
+  bool                     multiviewEnabled  = false;
+  bool                     textureCompressionBCEnabled = false;
   
   VkSwapchainKHR swapchain = VK_NULL_HANDLE;
   SwapchainFrame swapchainFrames[swapchainSize];
+  FrameInFlight framesInFlight[FRAMES_IN_FLIGHT];
   
   VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT msgType, const VkDebugUtilsMessengerCallbackDataEXT *data, void *pUserData) {
 
@@ -107,8 +119,18 @@ namespace gfx {
       extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     #endif
     
+    // Ask for Vulkan 1.1 (for multiview) if the loader has it. vkEnumerateInstanceVersion doesn't exist in 1.0 loaders.
+    auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+    if (enumerateInstanceVersion) enumerateInstanceVersion(&instanceVersion);
+    
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Light and Shadow";
+    appInfo.apiVersion = instanceVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+    
     VkInstanceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
     createInfo.enabledExtensionCount = (int)extensions.size();
     createInfo.ppEnabledExtensionNames = extensions.data();
     
@@ -175,6 +197,33 @@ namespace gfx {
     return info;
   }
 
+  // Multiview lets the shadow pass render every subsource in one pass. It's core in Vulkan 1.1, but not every device supports it or enough views.
+  static bool isMultiviewSupported() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physDevice, &properties);
+    if (instanceVersion < VK_API_VERSION_1_1 || properties.apiVersion < VK_API_VERSION_1_1) return false;
+    
+    auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2");
+    auto getProperties2 = (PFN_vkGetPhysicalDeviceProperties2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2");
+    if (!getFeatures2 || !getProperties2) return false;
+    
+    VkPhysicalDeviceMultiviewFeatures multiviewFeatures = {};
+    multiviewFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &multiviewFeatures;
+    getFeatures2(physDevice, &features2);
+    
+    VkPhysicalDeviceMultiviewProperties multiviewProperties = {};
+    multiviewProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &multiviewProperties;
+    getProperties2(physDevice, &properties2);
+    
+    return multiviewFeatures.multiview == VK_TRUE && multiviewProperties.maxMultiviewViewCount >= MAX_LIGHT_SUBSOURCE_COUNT;
+  }
+  
   static void createDeviceAndQueue() {
     
     VkDeviceQueueCreateInfo queueInfo = createQueueInfo();
@@ -185,10 +234,28 @@ namespace gfx {
     deviceCreateInfo.queueCreateInfoCount = 1;
     deviceCreateInfo.pQueueCreateInfos = &queueInfo;
     
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physDevice, &supportedFeatures);
+    
+    // Cooked textures are BC-compressed. Without support, gfx::loadImage decodes the source images instead.
+    textureCompressionBCEnabled = supportedFeatures.textureCompressionBC == VK_TRUE;
+    
     VkPhysicalDeviceFeatures enabledDeviceFeatures = {};
     enabledDeviceFeatures.samplerAnisotropy = VK_TRUE;
+    enabledDeviceFeatures.textureCompressionBC = textureCompressionBCEnabled ? VK_TRUE : VK_FALSE;
     deviceCreateInfo.pEnabledFeatures = &enabledDeviceFeatures;
     
+    VkPhysicalDeviceMultiviewFeatures multiviewFeatures = {};
+    multiviewFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+    multiviewEnabled = isMultiviewSupported();
+    
+    if (multiviewEnabled) {
+      multiviewFeatures.multiview = VK_TRUE;
+      deviceCreateInfo.pNext = &multiviewFeatures;
+    }
+    
+    printf("Multiview shadow pass: %s\n", multiviewEnabled ? "enabled" : "unsupported, falling back to one pass per subsource");
+    
     // Enable extensions
     deviceCreateInfo.enabledExtensionCount = (int)requiredDeviceExtensions.size();
     deviceCreateInfo.ppEnabledExtensionNames = requiredDeviceExtensions.data();
@@ -208,44 +275,31 @@ namespace gfx {
     queueFamilyIndex = queueInfo.queueFamilyIndex;
   }
   
-  static VkDeviceMemory allocateMemory(VkMemoryRequirements reqs, VkMemoryPropertyFlags properties) {
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = reqs.size;
-    allocInfo.memoryTypeIndex = getMemoryType(reqs.memoryTypeBits, properties);
-    
-    VkDeviceMemory memory = VK_NULL_HANDLE;
-    auto result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
-    SDL_assert_release(result == VK_SUCCESS);
-    
-    return memory;
-  }
-  
-  static VkDeviceMemory allocateAndBindMemory(VkBuffer buffer) {
+  static MemoryAllocation allocateAndBindMemory(VkBuffer buffer, VkMemoryPropertyFlags properties) {
     VkMemoryRequirements reqs = {};
     vkGetBufferMemoryRequirements(device, buffer, &reqs);
 
-    VkDeviceMemory memory = allocateMemory(reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    MemoryAllocation memory = allocateMemory(reqs, properties, true);
     
-    auto result = vkBindBufferMemory(device, buffer, memory, 0);
+    auto result = vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
     SDL_assert_release(result == VK_SUCCESS);
     
     return memory;
   }
   
-  static VkDeviceMemory allocateAndBindMemory(VkImage image, VkMemoryPropertyFlags properties) {
+  static MemoryAllocation allocateAndBindMemory(VkImage image, VkMemoryPropertyFlags properties) {
     VkMemoryRequirements reqs = {};
     vkGetImageMemoryRequirements(device, image, &reqs);
     
-    VkDeviceMemory memory = allocateMemory(reqs, properties);
+    MemoryAllocation memory = allocateMemory(reqs, properties, false);
     
-    auto result = vkBindImageMemory(device, image, memory, 0);
+    auto result = vkBindImageMemory(device, image, memory.memory, memory.offset);
     SDL_assert_release(result == VK_SUCCESS);
     
     return memory;
   }
   
-  void createBuffer(VkBufferUsageFlags usage, uint64_t dataSize, VkBuffer *bufferOut, VkDeviceMemory *memoryOut) {
+  void createBuffer(VkBufferUsageFlags usage, uint64_t dataSize, VkBuffer *bufferOut, MemoryAllocation *memoryOut, VkMemoryPropertyFlags properties) {
     
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -256,10 +310,10 @@ namespace gfx {
     auto result = vkCreateBuffer(device, &bufferInfo, nullptr, bufferOut);
     SDL_assert_release(result == VK_SUCCESS);
     
-    *memoryOut = allocateAndBindMemory(*bufferOut);
+    *memoryOut = allocateAndBindMemory(*bufferOut, properties);
   }
   
-  void createVec3Buffer(const vector<vec3> &vec3s, VkBuffer *bufferOut, VkDeviceMemory *memoryOut) {
+  void createVec3Buffer(const vector<vec3> &vec3s, VkBuffer *bufferOut, MemoryAllocation *memoryOut) {
     
     uint64_t dataSize = sizeof(vec3s[0]) * vec3s.size();
     createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, dataSize, bufferOut, memoryOut);
@@ -296,7 +350,7 @@ namespace gfx {
       swapchainFrames[i].index = i;
       
       VkImage msaaImage;
-      VkDeviceMemory msaaImageMemory;
+      MemoryAllocation msaaImageMemory;
       createImage(surfaceFormat, extent.width, extent.height, &msaaImage, &msaaImageMemory, MSAA_SETTING);
       
       swapchainFrames[i].msaaView = createImageView(msaaImage, surfaceFormat, VK_IMAGE_ASPECT_COLOR_BIT);
@@ -304,7 +358,26 @@ namespace gfx {
       swapchainFrames[i].resolvedView = createImageView(images[i], surfaceFormat, VK_IMAGE_ASPECT_COLOR_BIT);
       
       swapchainFrames[i].framebuffer = createFramebuffer(renderPass, {swapchainFrames[i].msaaView, swapchainFrames[i].resolvedView, depthImageView}, extent.width, extent.height);
-      swapchainFrames[i].cmdBuffer = createCommandBuffer();
+    }
+  }
+  
+  static void createFramesInFlight() {
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    
+    // Start signalled so that the first wait on each frame doesn't block forever
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    
+    for (int i = 0; i < FRAMES_IN_FLIGHT; i++) {
+      FrameInFlight &frame = framesInFlight[i];
+      frame.index = i;
+      frame.cmdBuffer = createCommandBuffer();
+      
+      SDL_assert_release(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.imageAvailableSemaphore) == VK_SUCCESS);
+      SDL_assert_release(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &frame.renderCompletedSemaphore) == VK_SUCCESS);
+      SDL_assert_release(vkCreateFence(device, &fenceInfo, nullptr, &frame.fence) == VK_SUCCESS);
     }
   }
   
@@ -347,13 +420,13 @@ namespace gfx {
     createSwapchainFrames();
   }
   
-  VkImageView createDepthImageAndView(uint32 width, uint32_t height, VkSampleCountFlagBits sampleCountFlag) {
+  VkImageView createDepthImageAndView(uint32 width, uint32_t height, VkSampleCountFlagBits sampleCountFlag, VkImageUsageFlags extraUsage) {
     SDL_assert_release(commandPool != VK_NULL_HANDLE);
     
     VkImage image;
-    VkDeviceMemory imageMemory;
+    MemoryAllocation imageMemory;
     
-    createImage(depthImageFormat, width, height, &image, &imageMemory, sampleCountFlag);
+    createImage(depthImageFormat, width, height, &image, &imageMemory, sampleCountFlag, 1, extraUsage);
 
     return createImageView(image, depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
   }
@@ -363,11 +436,12 @@ namespace gfx {
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.dstSubpass = 0;
 
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
+    // With several frames in flight, the previous frame may still be writing the shared depth attachment or sampling the attachment that this pass is about to overwrite.
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     
     return dependency;
   }
@@ -387,7 +461,7 @@ namespace gfx {
     return description;
   }
   
-  static void createSubpass(VkSubpassDescription *descriptionOut, VkSubpassDependency *dependencyOut, vector<VkAttachmentDescription> *attachmentsOut, vector<VkAttachmentReference> *attachmentRefsOut) {
+  static void createSubpass(VkSubpassDescription *descriptionOut, VkSubpassDependency *dependencyOut, vector<VkAttachmentDescription> *attachmentsOut, vector<VkAttachmentReference> *attachmentRefsOut, bool loadDepth) {
     
     // Hacky: attachmentRefsOut is passed out of this function on the stack to prevent its references in VkSubpassDescription from being deallocated before they're used. attachmentRefsOut doesn't need to be directly used by the caller of this function.
     
@@ -399,8 +473,15 @@ namespace gfx {
     // Resolved, single-sample-per-pixel color attachment
     attachmentsOut->push_back(createAttachmentDescription(surfaceFormat, false, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR));
     
-    // Depth attachment
-    attachmentsOut->push_back(createAttachmentDescription(depthImageFormat, true, VK_ATTACHMENT_STORE_OP_DONT_CARE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, MSAA_SETTING));
+    // Depth attachment. When it's loaded from the G-buffer pass, it stays read only.
+    VkImageLayout depthLayout = loadDepth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    
+    attachmentsOut->push_back(createAttachmentDescription(depthImageFormat, !loadDepth, VK_ATTACHMENT_STORE_OP_DONT_CARE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, MSAA_SETTING));
+    
+    if (loadDepth) {
+      attachmentsOut->back().loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+      attachmentsOut->back().initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    }
     
     // attachment references
     attachmentRefsOut->resize(0);
@@ -417,7 +498,7 @@ namespace gfx {
     
     VkAttachmentReference depthAttachmentRef = {};
     depthAttachmentRef.attachment = 2; // attachments[2]
-    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachmentRef.layout = depthLayout;
     attachmentRefsOut->push_back(depthAttachmentRef);
 
     memset(descriptionOut, 0, sizeof(VkSubpassDescription));
@@ -430,12 +511,12 @@ namespace gfx {
     *dependencyOut = createSubpassDependency();
   }
   
-  static VkRenderPass createRenderPass() {
+  static VkRenderPass createRenderPass(bool loadDepth) {
     VkSubpassDescription subpassDesc = {};
     VkSubpassDependency subpassDep = {};
     vector<VkAttachmentDescription> attachments;
     vector<VkAttachmentReference> attachmentRefs;
-    createSubpass(&subpassDesc, &subpassDep, &attachments, &attachmentRefs);
+    createSubpass(&subpassDesc, &subpassDep, &attachments, &attachmentRefs, loadDepth);
     
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -465,13 +546,17 @@ namespace gfx {
     samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     samplerPoolSize.descriptorCount = descriptorSetCount;
     
+    VkDescriptorPoolSize dynamicBufferPoolSize = {};
+    dynamicBufferPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    dynamicBufferPoolSize.descriptorCount = descriptorSetCount;
+    
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.maxSets = descriptorSetCount;
     poolInfo.flags = 0;
     
-    VkDescriptorPoolSize sizes[] = { bufferPoolSize, samplerPoolSize };
-    poolInfo.poolSizeCount = 2;
+    VkDescriptorPoolSize sizes[] = { bufferPoolSize, samplerPoolSize, dynamicBufferPoolSize };
+    poolInfo.poolSizeCount = 3;
     poolInfo.pPoolSizes = sizes;
     
     VkDescriptorPool pool;
@@ -500,22 +585,19 @@ namespace gfx {
     return layout;
   }
   
-  static VkDescriptorSet createDescSet(VkDescriptorPool pool, const VkDescriptorBufferInfo *optionalBufferInfo, const VkDescriptorImageInfo *optionalImageInfo) {
+  static VkDescriptorSet createDescSet(VkDescriptorPool pool, VkDescriptorType descType, const VkDescriptorBufferInfo *optionalBufferInfo, const VkDescriptorImageInfo *optionalImageInfo) {
     
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = pool;
     allocInfo.descriptorSetCount = 1;
     
-    VkDescriptorType descType;
-    
-    if (optionalBufferInfo) {
-      descType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-      allocInfo.pSetLayouts = &bufferDescLayout;
-    } else if (optionalImageInfo) {
-      descType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-      allocInfo.pSetLayouts = &samplerDescLayout;
-    } else SDL_assert_release(false);
+    switch (descType) {
+      case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER: allocInfo.pSetLayouts = &bufferDescLayout; break;
+      case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC: allocInfo.pSetLayouts = &dynamicBufferDescLayout; break;
+      case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: allocInfo.pSetLayouts = &samplerDescLayout; break;
+      default: SDL_assert_release(false); break; // Unsupported descriptor type.
+    };
     
     VkDescriptorSet descSet;
     auto result = vkAllocateDescriptorSets(device, &allocInfo, &descSet);
@@ -529,11 +611,13 @@ namespace gfx {
     writeDescriptorSet.descriptorType = descType;
     writeDescriptorSet.descriptorCount = 1;
     
-    if (descType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
-      writeDescriptorSet.pBufferInfo = optionalBufferInfo;
-    } else if (descType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
+    if (descType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
+      SDL_assert_release(optionalImageInfo != nullptr);
       writeDescriptorSet.pImageInfo = optionalImageInfo;
-    } else SDL_assert_release(false); // Unsupported descriptor type.
+    } else {
+      SDL_assert_release(optionalBufferInfo != nullptr);
+      writeDescriptorSet.pBufferInfo = optionalBufferInfo;
+    }
     
     vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, nullptr);
     
@@ -545,15 +629,24 @@ namespace gfx {
     bufferInfo.buffer = buffer;
     bufferInfo.offset = 0;
     bufferInfo.range = VK_WHOLE_SIZE;
-    return createDescSet(descriptorPool, &bufferInfo, nullptr);
+    return createDescSet(descriptorPool, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &bufferInfo, nullptr);
   }
   
-  VkDescriptorSet createDescSet(VkImageView imageView, VkSampler sampler) {
+  VkDescriptorSet createDynamicDescSet(VkBuffer buffer, uint64_t range) {
+    // The offset is supplied to vkCmdBindDescriptorSets instead, so only the range is fixed here.
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = range;
+    return createDescSet(descriptorPool, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, &bufferInfo, nullptr);
+  }
+  
+  VkDescriptorSet createDescSet(VkImageView imageView, VkSampler sampler, VkImageLayout imageLayout) {
     VkDescriptorImageInfo imageInfo = {};
-    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageLayout = imageLayout;
     imageInfo.imageView = imageView;
     imageInfo.sampler = sampler;
-    return createDescSet(descriptorPool, nullptr, &imageInfo);
+    return createDescSet(descriptorPool, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nullptr, &imageInfo);
   }
   
   void createCoreHandles(SDL_Window *window) {
@@ -578,11 +671,20 @@ namespace gfx {
     SDL_assert_release(queueFamilyIndex >= 0);
     
     createCommandPool();
+    createPipelineCache();
+    
+    // The deferred lighting pass samples the depth, which not every device supports at MSAA_SETTING samples
+    {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(physDevice, &properties);
+      depthImageSampleable = (properties.limits.sampledImageDepthSampleCounts & MSAA_SETTING) != 0;
+    }
     
     auto extent = getSurfaceExtent();
-    depthImageView = createDepthImageAndView(extent.width, extent.height, MSAA_SETTING);
+    depthImageView = createDepthImageAndView(extent.width, extent.height, MSAA_SETTING, depthImageSampleable ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
     
-    renderPass = createRenderPass();
+    renderPass = createRenderPass(false);
+    deferredRenderPass = createRenderPass(true);
     
     createSwapchain();
     
@@ -591,12 +693,51 @@ namespace gfx {
       SDL_assert_release(swapchainFrames[i].resolvedView != VK_NULL_HANDLE);
     }
     
+    createFramesInFlight();
+    
     descriptorPool = createDescPool(1024);
     bufferDescLayout = createDescSetLayout(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
     samplerDescLayout = createDescSetLayout(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    dynamicBufferDescLayout = createDescSetLayout(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    
+    createUniformRing();
+  }
+  
+  void createPipelineCache() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physDevice, &properties);
+    
+    // Only seed the cache with data saved by this exact device and driver
+    vector<uint8_t> initialData;
+    MappedFile file;
+    if (mapBinaryFile(pipelineCacheFilePath, &file)) {
+      auto header = (const PipelineCacheFileHeader*)file.data;
+      bool valid = file.size >= sizeof(PipelineCacheFileHeader)
+        && header->magic == pipelineCacheFileMagic
+        && header->dataSize == file.size - sizeof(PipelineCacheFileHeader)
+        && header->vendorID == properties.vendorID
+        && header->deviceID == properties.deviceID
+        && header->driverVersion == properties.driverVersion
+        && memcmp(header->pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+      
+      if (valid) initialData.assign(file.data + sizeof(PipelineCacheFileHeader), file.data + file.size);
+      unmapBinaryFile(&file);
+    }
+    
+    pipelineCacheWasLoaded = !initialData.empty();
+    if (pipelineCacheWasLoaded) printf("Loaded %i bytes of pipeline cache\n", (int)initialData.size());
+    else printf("No usable pipeline cache, so all pipelines will be compiled from scratch\n");
+    
+    VkPipelineCacheCreateInfo cacheInfo = {};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = initialData.size();
+    cacheInfo.pInitialData = initialData.data();
+    
+    auto result = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+    SDL_assert_release(result == VK_SUCCESS);
   }
   
-  void createImage(VkFormat format, uint32_t width, uint32_t height, VkImage *imageOut, VkDeviceMemory *memoryOut, VkSampleCountFlagBits sampleCountFlag) {
+  void createImage(VkFormat format, uint32_t width, uint32_t height, VkImage *imageOut, MemoryAllocation *memoryOut, VkSampleCountFlagBits sampleCountFlag, uint32_t layerCount, VkImageUsageFlags extraUsage, uint32_t mipLevels) {
     
     VkImageCreateInfo imageInfo = {};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -617,17 +758,23 @@ namespace gfx {
       imageInfo.usage = 0;
       imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT; // Enable data transfers to this image
       imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT; // Enable shader usage via a sampler
-      imageInfo.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; // Enable render-to-image
+      
+      // Enable render-to-image, except for formats that can't be rendered to (such as the block-compressed formats of cooked textures)
+      VkFormatProperties formatProperties;
+      vkGetPhysicalDeviceFormatProperties(physDevice, format, &formatProperties);
+      if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) imageInfo.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
       
       memoryProperties = 0;
     }
     
+    imageInfo.usage |= extraUsage;
+    
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
     imageInfo.extent.depth = 1; // This creates a 2D image
     
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = layerCount;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageInfo.samples = sampleCountFlag;
@@ -639,11 +786,11 @@ namespace gfx {
     *memoryOut = allocateAndBindMemory(*imageOut, memoryProperties);
   }
   
-  void createColorImage(uint32_t width, uint32_t height, VkImage *imageOut, VkDeviceMemory *memoryOut) {
+  void createColorImage(uint32_t width, uint32_t height, VkImage *imageOut, MemoryAllocation *memoryOut) {
     createImage(surfaceFormat, width, height, imageOut, memoryOut);
   }
   
-  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectMask) {
+  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectMask, VkImageViewType viewType, uint32_t baseLayer, uint32_t layerCount, uint32_t mipLevels) {
     
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -652,13 +799,13 @@ namespace gfx {
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = aspectMask;
     
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.viewType = viewType;
     
     viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.levelCount = mipLevels;
     
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = baseLayer;
+    viewInfo.subresourceRange.layerCount = layerCount;
     
     VkImageView view;
     auto result = vkCreateImageView(device, &viewInfo, nullptr, &view);
@@ -667,12 +814,17 @@ namespace gfx {
     return view;
   }
   
-  VkSampler createSampler() {
+  VkSampler createSampler(VkFilter filter, VkBorderColor borderColor) {
     VkSamplerCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     
-    info.magFilter = VK_FILTER_LINEAR; // or NEAREST
-    info.minFilter = VK_FILTER_LINEAR; // or NEAREST
+    info.magFilter = filter;
+    info.minFilter = filter;
+    
+    // Trilinear filtering across whatever mip levels the image view has
+    info.mipmapMode = filter == VK_FILTER_LINEAR ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    info.minLod = 0;
+    info.maxLod = VK_LOD_CLAMP_NONE;
     
     info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
     info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
@@ -684,7 +836,36 @@ namespace gfx {
     info.compareEnable = VK_FALSE;
     info.compareOp = VK_COMPARE_OP_ALWAYS;
     
-    info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    info.borderColor = borderColor;
+    info.unnormalizedCoordinates = VK_FALSE;
+    
+    VkSampler sampler;
+    auto result = vkCreateSampler(device, &info, nullptr, &sampler);
+    SDL_assert_release(result == VK_SUCCESS);
+    
+    return sampler;
+  }
+  
+  // For sampler2DShadow lookups. Each fetch compares the reference depth against the 4 nearest texels and bilinearly filters the results.
+  VkSampler createShadowSampler() {
+    VkSamplerCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    
+    info.magFilter = VK_FILTER_LINEAR;
+    info.minFilter = VK_FILTER_LINEAR;
+    
+    // Outside the shadowmap the depth reads as 1 (the far plane), so everything there is lit.
+    info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    
+    info.anisotropyEnable = VK_FALSE;
+    
+    // Lit when the reference depth is no further than the stored depth
+    info.compareEnable = VK_TRUE;
+    info.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    
     info.unnormalizedCoordinates = VK_FALSE;
     
     VkSampler sampler;
@@ -694,32 +875,48 @@ namespace gfx {
     return sampler;
   }
   
-  VkPipelineVertexInputStateCreateInfo allocVertexInputInfo(const vector<VkFormat> &attribFormats) {
+  static uint32_t getVertexFormatSize(VkFormat format) {
+    switch (format) {
+      case VK_FORMAT_R32G32B32_SFLOAT: return sizeof(vec3);
+      case VK_FORMAT_R32G32_SFLOAT: return sizeof(vec2);
+      case VK_FORMAT_R16G16B16A16_SNORM: return 8;
+      case VK_FORMAT_R16G16_SNORM: return 4;
+      case VK_FORMAT_R16G16_SFLOAT: return 4;
+      case VK_FORMAT_A2B10G10R10_SNORM_PACK32: return 4;
+      default: SDL_assert_release(false); return 0; // Unsupported format!
+    };
+  }
+  
+  VkPipelineVertexInputStateCreateInfo allocVertexInputInfo(const vector<vector<VkFormat>> &bindingAttribFormats) {
     VkPipelineVertexInputStateCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     
-    info.vertexBindingDescriptionCount = (uint32_t)attribFormats.size(); // I use only one binding per attribute.
-    info.vertexAttributeDescriptionCount = (uint32_t)attribFormats.size();
+    uint32_t attribCount = 0;
+    for (auto &formats : bindingAttribFormats) attribCount += (uint32_t)formats.size();
     
-    auto bindings = new VkVertexInputBindingDescription[attribFormats.size()];
-    auto attribs = new VkVertexInputAttributeDescription[attribFormats.size()];
+    info.vertexBindingDescriptionCount = (uint32_t)bindingAttribFormats.size();
+    info.vertexAttributeDescriptionCount = attribCount;
     
-    for (int i = 0; i < attribFormats.size(); i++) {
+    auto bindings = new VkVertexInputBindingDescription[bindingAttribFormats.size()];
+    auto attribs = new VkVertexInputAttributeDescription[attribCount];
+    
+    // Each binding interleaves its attributes in the order given. Locations are numbered across all bindings.
+    uint32_t location = 0;
+    for (int i = 0; i < bindingAttribFormats.size(); i++) {
       
       bindings[i].binding = i;
       bindings[i].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+      bindings[i].stride = 0;
       
-      // Set bindings[i].stride
-      switch (attribFormats[i]) {
-        case VK_FORMAT_R32G32B32_SFLOAT: bindings[i].stride = sizeof(vec3); break;
-        case VK_FORMAT_R32G32_SFLOAT: bindings[i].stride = sizeof(vec2); break;
-        default: SDL_assert_release(false); break; // Unsupported format!
-      };
-      
-      attribs[i].binding = i; // bindings[i]
-      attribs[i].location = i;
-      attribs[i].format = attribFormats[i];
-      attribs[i].offset = 0;
+      for (auto format : bindingAttribFormats[i]) {
+        attribs[location].binding = i; // bindings[i]
+        attribs[location].location = location;
+        attribs[location].format = format;
+        attribs[location].offset = bindings[i].stride;
+        
+        bindings[i].stride += getVertexFormatSize(format);
+        location++;
+      }
     }
     
     info.pVertexBindingDescriptions = bindings;
@@ -733,12 +930,12 @@ namespace gfx {
     delete [] info.pVertexAttributeDescriptions;
   }
   
-  static VkPipelineDepthStencilStateCreateInfo createDepthStencilInfo() {
+  static VkPipelineDepthStencilStateCreateInfo createDepthStencilInfo(VkBool32 depthWrite, VkCompareOp compareOp) {
     VkPipelineDepthStencilStateCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     info.depthTestEnable = VK_TRUE;
-    info.depthWriteEnable = VK_TRUE;
-    info.depthCompareOp = VK_COMPARE_OP_LESS; // Lower depth values mean closer to 'camera'
+    info.depthWriteEnable = depthWrite;
+    info.depthCompareOp = compareOp;
     info.depthBoundsTestEnable = VK_FALSE;
     info.stencilTestEnable = VK_FALSE;
     return info;
@@ -757,13 +954,13 @@ namespace gfx {
     return info;
   }
   
-  static VkPipelineColorBlendAttachmentState createColorBlendAttachment() {
+  static VkPipelineColorBlendAttachmentState createColorBlendAttachment(VkBool32 blendEnable) {
     VkPipelineColorBlendAttachmentState attachment = {};
     
     attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    attachment.blendEnable = VK_FALSE;
+    attachment.blendEnable = blendEnable;
     
-    // If blendEnable were VK_TRUE, the below settings would perform standard alpha blending.
+    // If blendEnable is VK_TRUE, the below settings perform standard alpha blending.
     
     // dstColor.rgb = (srcColor.rgb * srcColorBlendFactor) <colorBlendOp> (dstColor.rgb * dstColorBlendFactor);
     attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
@@ -835,89 +1032,162 @@ namespace gfx {
     return pipelineLayout;
   }
   
-  static VkPipelineShaderStageCreateInfo createShaderStage(const char *spirVFilePath, VkShaderStageFlagBits stage) {
-    auto spirV = loadBinaryFile(spirVFilePath);
+  // Shader modules by file path, and by SPIR-V content so that identical shaders under different names share a module. Modules live as long as the device.
+  static unordered_map<string, VkShaderModule> shaderModulesByPath;
+  static unordered_map<uint64_t, VkShaderModule> shaderModulesByHash;
+  
+  VkShaderModule getShaderModule(const char *spirVFilePath) {
+    auto found = shaderModulesByPath.find(spirVFilePath);
+    if (found != shaderModulesByPath.end()) return found->second;
 
-    VkShaderModuleCreateInfo moduleInfo = {};
-    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    moduleInfo.codeSize = spirV.size();
-    moduleInfo.pCode = (uint32_t*)spirV.data();
+    auto spirV = loadBinaryFile(spirVFilePath);
+    VkShaderModule &module = shaderModulesByHash[hashBytes(spirV.data(), spirV.size())];
 
-    VkShaderModule module = VK_NULL_HANDLE;
-    SDL_assert_release(vkCreateShaderModule(device, &moduleInfo, nullptr, &module) == VK_SUCCESS);
+    if (module == VK_NULL_HANDLE) {
+      VkShaderModuleCreateInfo moduleInfo = {};
+      moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      moduleInfo.codeSize = spirV.size();
+      moduleInfo.pCode = (uint32_t*)spirV.data();
+      
+      SDL_assert_release(vkCreateShaderModule(device, &moduleInfo, nullptr, &module) == VK_SUCCESS);
+    }
 
+    shaderModulesByPath[spirVFilePath] = module;
+    return module;
+  }
+  
+  static VkPipelineShaderStageCreateInfo createShaderStage(const char *spirVFilePath, VkShaderStageFlagBits stage, const VkSpecializationInfo *specializationInfo) {
     VkPipelineShaderStageCreateInfo stageInfo = {};
     stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 
     stageInfo.stage = stage;
 
-    stageInfo.module = module;
+    stageInfo.module = getShaderModule(spirVFilePath);
     stageInfo.pName = "main";
+    stageInfo.pSpecializationInfo = specializationInfo;
 
     return stageInfo;
   }
   
-  VkPipeline createPipeline(VkPipelineLayout layout, const vector<VkFormat> &vertexAttribFormats, VkExtent2D extent, VkRenderPass renderPass, VkCullModeFlags cullMode, const char *vertexShaderPath, const char *fragmentShaderPath, VkSampleCountFlagBits sampleCountFlag) {
-    VkPipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  // Everything a VkGraphicsPipelineCreateInfo points to, which has to outlive the vkCreateGraphicsPipelines() call
+  struct PipelineCreateState {
+    vector<VkPipelineShaderStageCreateInfo> shaderStages;
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+    VkPipelineViewportStateCreateInfo viewportInfo;
+    VkPipelineDepthStencilStateCreateInfo depthStencilInfo;
+    VkPipelineRasterizationStateCreateInfo rasterInfo;
+    VkPipelineMultisampleStateCreateInfo multisamplingInfo;
+    vector<VkPipelineColorBlendAttachmentState> colorBlendAttachments;
+    VkPipelineColorBlendStateCreateInfo colorBlending;
+  };
+  
+  static void fillPipelineInfo(const PipelineDesc &desc, PipelineCreateState *state, VkGraphicsPipelineCreateInfo *pipelineInfoOut) {
+    state->colorBlending = {};
+    state->colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     
-    colorBlending.logicOpEnable = VK_FALSE;
+    state->colorBlending.logicOpEnable = VK_FALSE;
     
-    auto colorBlendAttachment = createColorBlendAttachment();
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.attachmentCount = 1;
-
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    // A null fragment shader makes a depth-only pipeline, which has no color attachment unless desc.keepColorAttachment is set
+    bool depthOnly = desc.fragmentShaderPath == nullptr;
+    
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = createColorBlendAttachment(desc.blendEnable);
+    if (depthOnly) colorBlendAttachment.colorWriteMask = 0;
+    
+    state->colorBlendAttachments.assign(depthOnly && !desc.keepColorAttachment ? 0 : desc.colorAttachmentCount, colorBlendAttachment);
+    state->colorBlending.pAttachments = state->colorBlendAttachments.data();
+    state->colorBlending.attachmentCount = (uint32_t)state->colorBlendAttachments.size();
+    
+    VkGraphicsPipelineCreateInfo &pipelineInfo = *pipelineInfoOut;
+    pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     
-    vector<VkPipelineShaderStageCreateInfo> shaderStages = {
-      createShaderStage(vertexShaderPath, VK_SHADER_STAGE_VERTEX_BIT),
-      createShaderStage(fragmentShaderPath, VK_SHADER_STAGE_FRAGMENT_BIT)
+    state->shaderStages = {
+      createShaderStage(desc.vertexShaderPath, VK_SHADER_STAGE_VERTEX_BIT, desc.specializationInfo)
     };
-    pipelineInfo.stageCount = (int)shaderStages.size();
-    pipelineInfo.pStages = shaderStages.data();
     
-    auto vertexInputInfo = allocVertexInputInfo(vertexAttribFormats);
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    if (!depthOnly) state->shaderStages.push_back(createShaderStage(desc.fragmentShaderPath, VK_SHADER_STAGE_FRAGMENT_BIT, desc.specializationInfo));
     
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.stageCount = (int)state->shaderStages.size();
+    pipelineInfo.pStages = state->shaderStages.data();
     
-    auto viewportInfo = allocViewportInfo(extent);
-    pipelineInfo.pViewportState = &viewportInfo;
+    state->vertexInputInfo = allocVertexInputInfo(desc.vertexAttribFormats);
+    pipelineInfo.pVertexInputState = &state->vertexInputInfo;
     
-    VkPipelineDepthStencilStateCreateInfo depthStencilInfo = createDepthStencilInfo();
-    pipelineInfo.pDepthStencilState = &depthStencilInfo;
+    state->inputAssembly = {};
+    state->inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    state->inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    state->inputAssembly.primitiveRestartEnable = VK_FALSE;
+    pipelineInfo.pInputAssemblyState = &state->inputAssembly;
     
-    VkPipelineRasterizationStateCreateInfo rasterInfo = createRasterizationInfo(cullMode);
-    pipelineInfo.pRasterizationState = &rasterInfo;
+    state->viewportInfo = allocViewportInfo(desc.extent);
+    pipelineInfo.pViewportState = &state->viewportInfo;
     
-    VkPipelineMultisampleStateCreateInfo multisamplingInfo = {};
-    multisamplingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisamplingInfo.sampleShadingEnable = VK_FALSE;
-    multisamplingInfo.rasterizationSamples = sampleCountFlag;
-    pipelineInfo.pMultisampleState = &multisamplingInfo;
+    state->depthStencilInfo = createDepthStencilInfo(desc.depthWrite, desc.depthCompareOp);
+    pipelineInfo.pDepthStencilState = &state->depthStencilInfo;
     
-    pipelineInfo.pColorBlendState = &colorBlending;
+    state->rasterInfo = createRasterizationInfo(desc.cullMode);
+    pipelineInfo.pRasterizationState = &state->rasterInfo;
     
-    pipelineInfo.layout = layout;
+    state->multisamplingInfo = {};
+    state->multisamplingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    state->multisamplingInfo.sampleShadingEnable = VK_FALSE;
+    state->multisamplingInfo.rasterizationSamples = desc.sampleCountFlag;
+    pipelineInfo.pMultisampleState = &state->multisamplingInfo;
     
-    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.pColorBlendState = &state->colorBlending;
+    
+    pipelineInfo.layout = desc.layout;
+    
+    pipelineInfo.renderPass = desc.renderPass;
     
     pipelineInfo.subpass = 0;
+  }
+  
+  vector<VkPipeline> createPipelines(const vector<PipelineDesc> &descs) {
+    vector<PipelineCreateState> states(descs.size());
+    vector<VkGraphicsPipelineCreateInfo> pipelineInfos(descs.size());
+    for (size_t i = 0; i < descs.size(); i++) fillPipelineInfo(descs[i], &states[i], &pipelineInfos[i]);
+    
+    // Split the pipelines into one batch per core, each compiled by a single vkCreateGraphicsPipelines() call on its own thread. The pipeline cache is internally synchronized, so every batch shares it.
+    size_t batchCount = std::min((size_t)std::max(thread::hardware_concurrency(), 1u), descs.size());
+    size_t batchSize = batchCount > 0 ? (descs.size() + batchCount - 1) / batchCount : 0;
+    
+    vector<VkPipeline> pipelines(descs.size(), VK_NULL_HANDLE);
+    vector<function<void()>> jobs;
+    
+    for (size_t first = 0; first < descs.size(); first += batchSize) {
+      uint32_t count = (uint32_t)std::min(batchSize, descs.size() - first);
+      jobs.push_back([&, first, count]() {
+        auto result = vkCreateGraphicsPipelines(device, pipelineCache, count, &pipelineInfos[first], nullptr, &pipelines[first]);
+        SDL_assert_release(result == VK_SUCCESS);
+      });
+    }
     
-    VkPipeline pipeline;
-    SDL_assert_release(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) == VK_SUCCESS);
+    runInParallel(jobs);
     
     // Clean up
-    freeVertexInputInfo(vertexInputInfo);
-    freeViewportInfo(viewportInfo);
-    for (auto &stage : shaderStages) vkDestroyShaderModule(device, stage.module, nullptr);
+    for (auto &state : states) {
+      freeVertexInputInfo(state.vertexInputInfo);
+      freeViewportInfo(state.viewportInfo);
+    }
     
-    return pipeline;
+    return pipelines;
+  }
+  
+  VkPipeline createPipeline(VkPipelineLayout layout, const vector<vector<VkFormat>> &vertexAttribFormats, VkExtent2D extent, VkRenderPass renderPass, VkCullModeFlags cullMode, const char *vertexShaderPath, const char *fragmentShaderPath, VkSampleCountFlagBits sampleCountFlag, const VkSpecializationInfo *specializationInfo) {
+    PipelineDesc desc;
+    desc.layout = layout;
+    desc.vertexAttribFormats = vertexAttribFormats;
+    desc.extent = extent;
+    desc.renderPass = renderPass;
+    desc.cullMode = cullMode;
+    desc.vertexShaderPath = vertexShaderPath;
+    desc.fragmentShaderPath = fragmentShaderPath;
+    desc.sampleCountFlag = sampleCountFlag;
+    desc.specializationInfo = specializationInfo;
+    
+    return createPipelines({desc})[0];
   }
 }
 
@@ -131,6 +131,27 @@ namespace gfx {
     return 0;
   }
   
+  // A full mip chain, or a single level if the format can't be blitted with linear filtering
+  uint32_t getMipLevelCount(VkFormat format, uint32_t width, uint32_t height) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physDevice, format, &properties);
+    
+    VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if ((properties.optimalTilingFeatures & required) != required) {
+      printf("Format %i can't be blitted, so it won't be mipmapped\n", (int)format);
+      return 1;
+    }
+    
+    uint32_t levels = 1;
+    uint32_t size = width > height ? width : height;
+    while (size > 1) {
+      size /= 2;
+      levels++;
+    }
+    
+    return levels;
+  }
+  
   VkExtent2D getSurfaceExtent() {
     VkSurfaceCapabilitiesKHR capabilities;
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physDevice, surface, &capabilities);
@@ -146,16 +167,40 @@ namespace gfx {
     return images;
   }
   
-  SwapchainFrame* getNextFrame(VkSemaphore imageAvailableSemaphore) {
-    SDL_assert(imageAvailableSemaphore != VK_NULL_HANDLE);
+  FrameInFlight* getNextFrameInFlight() {
+    static uint32_t nextIndex = 0;
+    FrameInFlight *frame = &framesInFlight[nextIndex];
+    nextIndex = (nextIndex + 1) % FRAMES_IN_FLIGHT;
+    
+    // Wait until the GPU has finished with this frame's command buffer and uniform ring segment
+    auto result = vkWaitForFences(device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+    SDL_assert(result == VK_SUCCESS);
+    
+    beginUniformFrame(frame->index);
+    
+    return frame;
+  }
+  
+  SwapchainFrame* getNextFrame(FrameInFlight *frameInFlight) {
+    SDL_assert(frameInFlight->imageAvailableSemaphore != VK_NULL_HANDLE);
     
-    // Get next swapchain image
     // Get the next swapchain image and signal the semaphore.
     uint32_t swapchainIndex = INT32_MAX;
-    auto result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX /* no timeout */, imageAvailableSemaphore, VK_NULL_HANDLE, &swapchainIndex);
+    auto result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX /* no timeout */, frameInFlight->imageAvailableSemaphore, VK_NULL_HANDLE, &swapchainIndex);
     SDL_assert(result == VK_SUCCESS);
     
-    return &swapchainFrames[swapchainIndex];
+    SwapchainFrame *frame = &swapchainFrames[swapchainIndex];
+    
+    // The image can be handed out again while an older frame in flight is still rendering to it
+    if (frame->lastUserFence != VK_NULL_HANDLE && frame->lastUserFence != frameInFlight->fence) {
+      vkWaitForFences(device, 1, &frame->lastUserFence, VK_TRUE, UINT64_MAX);
+    }
+    frame->lastUserFence = frameInFlight->fence;
+    
+    // Only reset once an image has been acquired, so the fence is guaranteed to be signalled by this frame's submission.
+    vkResetFences(device, 1, &frameInFlight->fence);
+    
+    return frame;
   }
 }
 
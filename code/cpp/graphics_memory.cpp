@@ -0,0 +1,478 @@
+#include "graphics.h"
+#include "settings.h"
+
+namespace gfx {
+
+  // Allocations larger than this get a dedicated block of their own.
+  const VkDeviceSize memoryBlockSize = 64 * 1024 * 1024;
+
+  struct MemoryRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint8_t *mapped = nullptr;
+    uint32_t allocationCount = 0;
+
+    // Sorted by offset. Neighbouring ranges are always merged.
+    vector<MemoryRange> freeRanges;
+  };
+
+  // Buffers (linear) and optimal-tiling images are kept in separate pools so that bufferImageGranularity never has to be considered.
+  struct MemoryPool {
+    uint32_t memoryType;
+    bool linear;
+    vector<MemoryBlock> blocks;
+  };
+
+  static vector<MemoryPool> pools;
+
+  static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  static MemoryPool * getPool(uint32_t memoryType, bool linear) {
+    for (auto &pool : pools) {
+      if (pool.memoryType == memoryType && pool.linear == linear) return &pool;
+    }
+
+    MemoryPool pool;
+    pool.memoryType = memoryType;
+    pool.linear = linear;
+    pools.push_back(pool);
+    return &pools.back();
+  }
+
+  static MemoryBlock createBlock(uint32_t memoryType, VkDeviceSize size) {
+    MemoryBlock block;
+    block.size = size;
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    auto result = vkAllocateMemory(device, &allocInfo, nullptr, &block.memory);
+    SDL_assert_release(result == VK_SUCCESS);
+
+    // Host-visible blocks stay mapped for their whole lifetime, as a VkDeviceMemory can only be mapped once at a time.
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physDevice, &memoryProperties);
+
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      result = vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, (void**)&block.mapped);
+      SDL_assert_release(result == VK_SUCCESS);
+    }
+
+    block.freeRanges.push_back({0, size});
+    return block;
+  }
+
+  // Carve an aligned sub-range out of a block's free list (first fit). Returns false if the block has no room.
+  static bool allocateFromBlock(MemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offsetOut) {
+    for (int i = 0; i < block->freeRanges.size(); i++) {
+      MemoryRange range = block->freeRanges[i];
+      VkDeviceSize offset = alignUp(range.offset, alignment);
+      VkDeviceSize padding = offset - range.offset;
+
+      if (padding + size > range.size) continue;
+
+      block->freeRanges.erase(block->freeRanges.begin() + i);
+
+      // Return the unused space on either side of the allocation to the free list
+      VkDeviceSize tailSize = range.size - padding - size;
+      if (tailSize > 0) block->freeRanges.insert(block->freeRanges.begin() + i, {offset + size, tailSize});
+      if (padding > 0) block->freeRanges.insert(block->freeRanges.begin() + i, {range.offset, padding});
+
+      block->allocationCount++;
+      *offsetOut = offset;
+      return true;
+    }
+
+    return false;
+  }
+
+  MemoryAllocation allocateMemory(VkMemoryRequirements reqs, VkMemoryPropertyFlags properties, bool linear) {
+    uint32_t memoryType = getMemoryType(reqs.memoryTypeBits, properties);
+    MemoryPool *pool = getPool(memoryType, linear);
+
+    MemoryAllocation allocation;
+    allocation.memoryType = memoryType;
+    allocation.linear = linear;
+    allocation.size = reqs.size;
+
+    VkDeviceSize offset = 0;
+    int blockIndex;
+    for (blockIndex = 0; blockIndex < pool->blocks.size(); blockIndex++) {
+      if (allocateFromBlock(&pool->blocks[blockIndex], reqs.size, reqs.alignment, &offset)) break;
+    }
+
+    if (blockIndex == pool->blocks.size()) {
+      VkDeviceSize blockSize = reqs.size > memoryBlockSize ? reqs.size : memoryBlockSize;
+      pool->blocks.push_back(createBlock(memoryType, blockSize));
+
+      bool allocated = allocateFromBlock(&pool->blocks.back(), reqs.size, reqs.alignment, &offset);
+      SDL_assert_release(allocated);
+    }
+
+    MemoryBlock &block = pool->blocks[blockIndex];
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.mapped = block.mapped ? block.mapped + offset : nullptr;
+    allocation.blockIndex = blockIndex;
+
+    return allocation;
+  }
+
+  void freeMemory(MemoryAllocation *allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) return;
+
+    MemoryPool *pool = getPool(allocation->memoryType, allocation->linear);
+    SDL_assert_release(allocation->blockIndex < pool->blocks.size());
+    MemoryBlock &block = pool->blocks[allocation->blockIndex];
+    SDL_assert_release(block.memory == allocation->memory);
+
+    auto &ranges = block.freeRanges;
+
+    // Find the insertion point that keeps the free list sorted
+    int i = 0;
+    while (i < ranges.size() && ranges[i].offset < allocation->offset) i++;
+    ranges.insert(ranges.begin() + i, {allocation->offset, allocation->size});
+
+    // Merge with the following range, then with the preceding range
+    if (i+1 < ranges.size() && ranges[i].offset + ranges[i].size == ranges[i+1].offset) {
+      ranges[i].size += ranges[i+1].size;
+      ranges.erase(ranges.begin() + i+1);
+    }
+
+    if (i > 0 && ranges[i-1].offset + ranges[i-1].size == ranges[i].offset) {
+      ranges[i-1].size += ranges[i].size;
+      ranges.erase(ranges.begin() + i);
+    }
+
+    block.allocationCount--;
+
+    // Blocks are kept even when empty, so that allocation indices stay valid and the next allocation doesn't pay for vkAllocateMemory again.
+    *allocation = MemoryAllocation();
+  }
+
+  MemoryStats getMemoryStats() {
+    MemoryStats stats;
+    VkDeviceSize totalFree = 0;
+
+    for (auto &pool : pools) {
+      for (auto &block : pool.blocks) {
+        stats.blockCount++;
+        stats.allocationCount += block.allocationCount;
+        stats.bytesReserved += block.size;
+        stats.freeRangeCount += (uint32_t)block.freeRanges.size();
+
+        for (auto &range : block.freeRanges) {
+          totalFree += range.size;
+          if (range.size > stats.largestFreeRange) stats.largestFreeRange = range.size;
+        }
+      }
+    }
+
+    stats.bytesUsed = stats.bytesReserved - totalFree;
+
+    // 0 when all free space is contiguous, approaching 1 as it splinters into many small ranges.
+    stats.fragmentation = totalFree > 0 ? 1.0f - stats.largestFreeRange / (float)totalFree : 0.0f;
+
+    return stats;
+  }
+
+  void printMemoryStats() {
+    auto stats = getMemoryStats();
+    const float mebibyte = 1024 * 1024;
+
+    printf("\nDevice memory:\n");
+    printf("\t%u blocks, %u allocations\n", stats.blockCount, stats.allocationCount);
+    printf("\t%.1f MiB used of %.1f MiB reserved (%.1f%% full)\n", stats.bytesUsed / mebibyte, stats.bytesReserved / mebibyte, stats.bytesReserved > 0 ? 100.0f * stats.bytesUsed / stats.bytesReserved : 0.0f);
+    printf("\t%u free ranges, largest %.1f MiB, fragmentation %.3f\n", stats.freeRangeCount, stats.largestFreeRange / mebibyte, stats.fragmentation);
+  }
+  
+  // Per-frame uniform ring buffer. Uniform data is written into the segment belonging to the frame being recorded, so frames still in flight keep reading their own copies. Shaders see it through UNIFORM_BUFFER_DYNAMIC descriptors whose offsets are supplied at bind time.
+  
+  static VkBuffer         uniformRingBuffer = VK_NULL_HANDLE;
+  static MemoryAllocation uniformRingMemory;
+  static VkDeviceSize     uniformRingAlignment = 0;
+  static VkDeviceSize     uniformRingHead = 0;
+  static VkDeviceSize     uniformRingFrameEnd = 0;
+  
+  // One descriptor set per distinct uniform struct size, as the range is baked into the descriptor.
+  static vector<pair<uint64_t, VkDescriptorSet>> uniformRingDescSets;
+  
+  void createUniformRing() {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physDevice, &properties);
+    uniformRingAlignment = properties.limits.minUniformBufferOffsetAlignment;
+    
+    createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, UNIFORM_RING_FRAME_SIZE * FRAMES_IN_FLIGHT, &uniformRingBuffer, &uniformRingMemory);
+    SDL_assert_release(uniformRingMemory.mapped != nullptr);
+  }
+  
+  void beginUniformFrame(uint32_t frameIndex) {
+    SDL_assert(frameIndex < FRAMES_IN_FLIGHT);
+    uniformRingHead = frameIndex * (VkDeviceSize)UNIFORM_RING_FRAME_SIZE;
+    uniformRingFrameEnd = uniformRingHead + UNIFORM_RING_FRAME_SIZE;
+  }
+  
+  uint32_t pushUniformData(uint64_t dataSize, const void *data) {
+    VkDeviceSize offset = alignUp(uniformRingHead, uniformRingAlignment);
+    SDL_assert_release(offset + dataSize <= uniformRingFrameEnd); // UNIFORM_RING_FRAME_SIZE is too small
+    
+    memcpy(uniformRingMemory.mapped + offset, data, dataSize);
+    uniformRingHead = offset + dataSize;
+    
+    return (uint32_t)offset;
+  }
+  
+  VkDescriptorSet getUniformRingDescSet(uint64_t range) {
+    for (auto &entry : uniformRingDescSets) {
+      if (entry.first == range) return entry.second;
+    }
+    
+    VkDescriptorSet descSet = createDynamicDescSet(uniformRingBuffer, range);
+    uniformRingDescSets.push_back({range, descSet});
+    return descSet;
+  }
+  
+  // Staging upload queue. Data bound for DEVICE_LOCAL buffers and images is copied into a host-visible staging buffer straight away, while the GPU copies are only recorded when the queue is flushed: all of them, along with the layout transitions of the images, go into one command buffer whose completion is waited on through one fence.
+  
+  struct PendingBufferCopy {
+    VkBuffer dstBuffer;
+    VkBufferCopy region;
+  };
+  
+  // A band of rows of one mip level of an image. Images too large for the staging buffer arrive in several bands, possibly across several flushes.
+  struct PendingImageCopy {
+    VkImage dstImage;
+    VkBufferImageCopy region;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    bool generateMips; // blit levels 1+ from level 0, rather than having them uploaded
+    bool firstBand; // transition from UNDEFINED before copying
+    bool lastBand;  // generate the lower mip levels if needed, and transition to SHADER_READ_ONLY after copying
+  };
+  
+  static VkBuffer          stagingBuffer = VK_NULL_HANDLE;
+  static MemoryAllocation  stagingMemory;
+  static VkDeviceSize      stagingHead = 0;
+  static VkCommandBuffer   uploadCmdBuffer = VK_NULL_HANDLE;
+  static VkFence           uploadFence = VK_NULL_HANDLE;
+  static vector<PendingBufferCopy> pendingBufferCopies;
+  static vector<PendingImageCopy>  pendingImageCopies;
+  
+  static void createUploadQueue() {
+    createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, STAGING_BUFFER_SIZE, &stagingBuffer, &stagingMemory);
+    SDL_assert_release(stagingMemory.mapped != nullptr);
+    
+    uploadCmdBuffer = createCommandBuffer();
+    
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    SDL_assert_release(vkCreateFence(device, &fenceInfo, nullptr, &uploadFence) == VK_SUCCESS);
+  }
+  
+  // Returns the offset of free staging space and how many bytes are available there, flushing first if the staging buffer has less than minSize left.
+  static VkDeviceSize reserveStagingSpace(VkDeviceSize minSize, VkDeviceSize *availableOut) {
+    if (stagingBuffer == VK_NULL_HANDLE) createUploadQueue();
+    
+    VkDeviceSize offset = alignUp(stagingHead, 16);
+    if (offset + minSize > STAGING_BUFFER_SIZE) {
+      flushUploads();
+      offset = 0;
+    }
+    
+    *availableOut = STAGING_BUFFER_SIZE - offset;
+    return offset;
+  }
+  
+  void uploadBufferData(VkBuffer dstBuffer, VkDeviceSize dstOffset, uint64_t dataSize, const void *data) {
+    
+    // Anything bigger than the staging buffer is uploaded in staging-buffer-sized pieces
+    while (dataSize > 0) {
+      VkDeviceSize available;
+      VkDeviceSize offset = reserveStagingSpace(1, &available);
+      
+      VkDeviceSize chunkSize = dataSize < available ? dataSize : available;
+      memcpy(stagingMemory.mapped + offset, data, chunkSize);
+      
+      PendingBufferCopy copy;
+      copy.dstBuffer = dstBuffer;
+      copy.region.srcOffset = offset;
+      copy.region.dstOffset = dstOffset;
+      copy.region.size = chunkSize;
+      pendingBufferCopies.push_back(copy);
+      
+      stagingHead = offset + chunkSize;
+      dstOffset += chunkSize;
+      data = (const uint8_t*)data + chunkSize;
+      dataSize -= chunkSize;
+    }
+  }
+  
+  // Queues one mip level in bands of whole rows of blocks. Uncompressed formats have 1x1 blocks.
+  static void queueImageLevel(VkImage dstImage, uint32_t mipLevel, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t blockSize, uint32_t bytesPerBlock, const void *data, bool firstLevel, bool lastLevel, bool generateMips) {
+    const uint32_t blockRowCount = (height + blockSize - 1) / blockSize;
+    const VkDeviceSize blockRowSize = (width + blockSize - 1) / blockSize * (VkDeviceSize)bytesPerBlock;
+    SDL_assert_release(blockRowSize <= STAGING_BUFFER_SIZE);
+    
+    uint32_t blockRow = 0;
+    while (blockRow < blockRowCount) {
+      VkDeviceSize available;
+      VkDeviceSize offset = reserveStagingSpace(blockRowSize, &available);
+      
+      uint32_t bandBlockRows = (uint32_t)(available / blockRowSize);
+      if (bandBlockRows > blockRowCount - blockRow) bandBlockRows = blockRowCount - blockRow;
+      
+      memcpy(stagingMemory.mapped + offset, (const uint8_t*)data + blockRow * blockRowSize, bandBlockRows * blockRowSize);
+      
+      // Bands of compressed images may only end off a block boundary at the bottom edge
+      uint32_t row = blockRow * blockSize;
+      uint32_t rowCount = bandBlockRows * blockSize;
+      if (rowCount > height - row) rowCount = height - row;
+      
+      PendingImageCopy copy;
+      copy.dstImage = dstImage;
+      copy.region = {};
+      copy.region.bufferOffset = offset;
+      copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      copy.region.imageSubresource.mipLevel = mipLevel;
+      copy.region.imageSubresource.baseArrayLayer = 0;
+      copy.region.imageSubresource.layerCount = 1;
+      copy.region.imageOffset = {0, (int32_t)row, 0};
+      copy.region.imageExtent = {width, rowCount, 1};
+      copy.width = width;
+      copy.height = height;
+      copy.mipLevels = mipLevels;
+      copy.generateMips = generateMips;
+      copy.firstBand = firstLevel && blockRow == 0;
+      copy.lastBand = lastLevel && blockRow + bandBlockRows == blockRowCount;
+      pendingImageCopies.push_back(copy);
+      
+      stagingHead = offset + bandBlockRows * blockRowSize;
+      blockRow += bandBlockRows;
+    }
+  }
+  
+  void uploadImageData(VkImage dstImage, uint32_t width, uint32_t height, uint32_t bytesPerPixel, const void *data, uint32_t mipLevels) {
+    queueImageLevel(dstImage, 0, mipLevels, width, height, 1, bytesPerPixel, data, true, true, true);
+  }
+  
+  void uploadCompressedImageLevel(VkImage dstImage, uint32_t mipLevel, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t blockSize, uint32_t bytesPerBlock, const void *data) {
+    queueImageLevel(dstImage, mipLevel, mipLevels, width, height, blockSize, bytesPerBlock, data, mipLevel == 0, mipLevel == mipLevels-1, false);
+  }
+  
+  static VkImageMemoryBarrier createUploadBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess, uint32_t baseMipLevel, uint32_t levelCount) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = baseMipLevel;
+    barrier.subresourceRange.levelCount = levelCount;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    return barrier;
+  }
+  
+  void flushUploads() {
+    if (pendingBufferCopies.empty() && pendingImageCopies.empty()) return;
+    
+    beginCommandBuffer(uploadCmdBuffer);
+    
+    // Every image receiving its first band becomes a transfer destination (all mip levels), in one barrier
+    vector<VkImageMemoryBarrier> preCopyBarriers;
+    vector<PendingImageCopy*> completedImages;
+    
+    for (auto &copy : pendingImageCopies) {
+      if (copy.firstBand) preCopyBarriers.push_back(createUploadBarrier(copy.dstImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT, 0, copy.mipLevels));
+      if (copy.lastBand) completedImages.push_back(&copy);
+    }
+    
+    if (!preCopyBarriers.empty()) {
+      vkCmdPipelineBarrier(uploadCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)preCopyBarriers.size(), preCopyBarriers.data());
+    }
+    
+    for (auto &copy : pendingBufferCopies) {
+      vkCmdCopyBuffer(uploadCmdBuffer, stagingBuffer, copy.dstBuffer, 1, &copy.region);
+    }
+    
+    for (auto &copy : pendingImageCopies) {
+      vkCmdCopyBufferToImage(uploadCmdBuffer, stagingBuffer, copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy.region);
+    }
+    
+    // Build the mip chains of the completed images, one level at a time across all of them: each level is blitted from the previous one, which is first made a transfer source.
+    for (uint32_t level = 1; ; level++) {
+      vector<VkImageMemoryBarrier> levelBarriers;
+      for (auto image : completedImages) {
+        if (image->generateMips && level < image->mipLevels) levelBarriers.push_back(createUploadBarrier(image->dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, level-1, 1));
+      }
+      
+      if (levelBarriers.empty()) break;
+      vkCmdPipelineBarrier(uploadCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, (uint32_t)levelBarriers.size(), levelBarriers.data());
+      
+      for (auto image : completedImages) {
+        if (!image->generateMips || level >= image->mipLevels) continue;
+        
+        int32_t srcWidth = image->width >> (level-1);
+        int32_t srcHeight = image->height >> (level-1);
+        
+        VkImageBlit blit = {};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level-1, 0, 1};
+        blit.srcOffsets[1] = {srcWidth > 1 ? srcWidth : 1, srcHeight > 1 ? srcHeight : 1, 1};
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        blit.dstOffsets[1] = {srcWidth > 1 ? srcWidth/2 : 1, srcHeight > 1 ? srcHeight/2 : 1, 1};
+        
+        vkCmdBlitImage(uploadCmdBuffer, image->dstImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+      }
+    }
+    
+    // Every level but the last of a generated mip chain is now a transfer source, while uploaded levels are all still transfer destinations
+    vector<VkImageMemoryBarrier> postCopyBarriers;
+    for (auto image : completedImages) {
+      if (!image->generateMips) {
+        postCopyBarriers.push_back(createUploadBarrier(image->dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, image->mipLevels));
+        continue;
+      }
+      
+      uint32_t lastLevel = image->mipLevels - 1;
+      if (lastLevel > 0) postCopyBarriers.push_back(createUploadBarrier(image->dstImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, 0, lastLevel));
+      postCopyBarriers.push_back(createUploadBarrier(image->dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, lastLevel, 1));
+    }
+    
+    // Make the buffer copies visible to vertex input and the completed images visible to shaders
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+    
+    VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    vkCmdPipelineBarrier(uploadCmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0, 1, &barrier, 0, nullptr, (uint32_t)postCopyBarriers.size(), postCopyBarriers.data());
+    
+    vkEndCommandBuffer(uploadCmdBuffer);
+    submitCommandBuffer(uploadCmdBuffer, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, uploadFence);
+    
+    // The staging buffer can't be reused until the copies out of it are done
+    auto result = vkWaitForFences(device, 1, &uploadFence, VK_TRUE, UINT64_MAX);
+    SDL_assert_release(result == VK_SUCCESS);
+    vkResetFences(device, 1, &uploadFence);
+    
+    printf("Flushed %i staged buffer copies and %i image copies (%.1f KiB)\n", (int)pendingBufferCopies.size(), (int)pendingImageCopies.size(), stagingHead / 1024.0f);
+    
+    pendingBufferCopies.clear();
+    pendingImageCopies.clear();
+    stagingHead = 0;
+  }
+}
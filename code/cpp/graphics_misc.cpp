@@ -1,32 +1,135 @@
 #include "graphics.h"
+#include "cookedTexture.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 namespace gfx {
-  void loadImage(const char *filePath, bool normalMap, VkImage *imageOut, VkDeviceMemory *memoryOut, VkImageView *viewOut) {
-    VkFormat format = normalMap ? VK_FORMAT_R8G8B8A8_SNORM : VK_FORMAT_R8G8B8A8_UNORM;
+  // Reads a texture written by the texture cooker. Returns false if there's no cooked file.
+  static bool readCookedImageFile(const char *filePath, ImageFile *imageFileOut) {
+    FILE *file = fopen(filePath, "rb");
+    if (file == nullptr) return false;
+    fclose(file);
+    
+    auto bytes = loadBinaryFile(filePath);
+    SDL_assert_release(bytes.size() >= sizeof(cookedTexture::Header));
+    
+    auto header = (const cookedTexture::Header*)bytes.data();
+    SDL_assert_release(memcmp(header->identifier, cookedTexture::identifier, sizeof(cookedTexture::identifier)) == 0);
+    SDL_assert_release(header->layerCount == 0 && header->faceCount == 1 && header->supercompressionScheme == 0);
+    SDL_assert_release(cookedTexture::getBytesPerBlock((VkFormat)header->vkFormat) > 0);
+    SDL_assert_release(header->pixelWidth > 0 && header->pixelHeight > 0);
+    
+    // A level count of 0 means "generate the mips" in KTX2, which the cooker never writes
+    SDL_assert_release(header->levelCount >= 1 && header->levelCount <= cookedTexture::getFullLevelCount(header->pixelWidth, header->pixelHeight));
+    SDL_assert_release(sizeof(cookedTexture::Header) + header->levelCount * sizeof(cookedTexture::LevelIndex) <= bytes.size());
+    
+    // The upload copies each level's size as computed from the dimensions, so the stored lengths have to agree with it
+    auto levels = (const cookedTexture::LevelIndex*)(bytes.data() + sizeof(cookedTexture::Header));
+    for (uint32_t level = 0; level < header->levelCount; level++) {
+      SDL_assert_release(levels[level].byteLength == cookedTexture::getLevelByteLength((VkFormat)header->vkFormat, header->pixelWidth, header->pixelHeight, level));
+      SDL_assert_release(levels[level].byteLength <= bytes.size() && levels[level].byteOffset <= bytes.size() - levels[level].byteLength);
+    }
+    
+    imageFileOut->format = (VkFormat)header->vkFormat;
+    imageFileOut->width = header->pixelWidth;
+    imageFileOut->height = header->pixelHeight;
+    imageFileOut->cooked = true;
+    imageFileOut->bytes = move(bytes);
+    return true;
+  }
+  
+  void readImageFile(const char *filePath, bool normalMap, ImageFile *imageFileOut) {
+    
+    // Prefer the cooked version of the image if the device can sample it
+    if (textureCompressionBCEnabled && readCookedImageFile(cookedTexture::getCookedPath(filePath).c_str(), imageFileOut)) return;
     
     int width, height, componentsPerPixel;
     uint8_t *data = stbi_load(filePath, &width, &height, &componentsPerPixel, 4);
     SDL_assert_release(data != nullptr);
     
     if (normalMap) {
-      for (uint32_t i = 0; i < width*height*4; i += 4) {
-        data[i] = data[i] - 127;
-        data[i+1] = data[i+2] / 2;
-        data[i+2] = data[i+1] - 127;
+      for (uint32_t i = 0; i < width*height*4; i += 4) cookedTexture::convertNormalMapTexel(&data[i]);
+    }
+    
+    imageFileOut->format = normalMap ? VK_FORMAT_R8G8B8A8_SNORM : VK_FORMAT_R8G8B8A8_UNORM;
+    imageFileOut->width = width;
+    imageFileOut->height = height;
+    imageFileOut->cooked = false;
+    imageFileOut->bytes.assign(data, data + width*height*4);
+    stbi_image_free(data);
+  }
+  
+  void createImageFromFile(const ImageFile &imageFile, VkImage *imageOut, MemoryAllocation *memoryOut, VkImageView *viewOut) {
+    
+    // Cooked mip levels are uploaded as they are, with no decoding
+    if (imageFile.cooked) {
+      auto header = (const cookedTexture::Header*)imageFile.bytes.data();
+      auto levels = (const cookedTexture::LevelIndex*)(imageFile.bytes.data() + sizeof(cookedTexture::Header));
+      uint32_t bytesPerBlock = cookedTexture::getBytesPerBlock(imageFile.format);
+      
+      createImage(imageFile.format, imageFile.width, imageFile.height, imageOut, memoryOut, VK_SAMPLE_COUNT_1_BIT, 1, 0, header->levelCount);
+      
+      for (uint32_t level = 0; level < header->levelCount; level++) {
+        uint32_t width = imageFile.width >> level;
+        uint32_t height = imageFile.height >> level;
+        uploadCompressedImageLevel(*imageOut, level, header->levelCount, width > 0 ? width : 1, height > 0 ? height : 1, cookedTexture::blockSize, bytesPerBlock, imageFile.bytes.data() + levels[level].byteOffset);
       }
+      
+      *viewOut = createImageView(*imageOut, imageFile.format, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 0, 1, header->levelCount);
+      return;
     }
     
-    gfx::createImage(format, width, height, imageOut, memoryOut);
+    uint32_t mipLevels = getMipLevelCount(imageFile.format, imageFile.width, imageFile.height);
     
-    gfx::setImageMemoryRGBA(*imageOut, *memoryOut, width, height, data);
+    // The lower mip levels are blitted from the top one, so the image is also a transfer source
+    gfx::createImage(imageFile.format, imageFile.width, imageFile.height, imageOut, memoryOut, VK_SAMPLE_COUNT_1_BIT, 1, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipLevels);
     
-    *viewOut = gfx::createImageView(*imageOut, format, VK_IMAGE_ASPECT_COLOR_BIT);
-    stbi_image_free(data);
+    gfx::setImageMemoryRGBA(*imageOut, imageFile.width, imageFile.height, imageFile.bytes.data(), mipLevels);
+    
+    *viewOut = gfx::createImageView(*imageOut, imageFile.format, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_2D, 0, 1, mipLevels);
   }
+  
+  void loadImage(const char *filePath, bool normalMap, VkImage *imageOut, MemoryAllocation *memoryOut, VkImageView *viewOut) {
+    ImageFile imageFile;
+    readImageFile(filePath, normalMap, &imageFile);
+    createImageFromFile(imageFile, imageOut, memoryOut, viewOut);
+  }
+    
+  void savePipelineCache() {
+    size_t dataSize;
+    auto result = vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+    SDL_assert_release(result == VK_SUCCESS);
+    
+    vector<uint8_t> data(dataSize);
+    result = vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data());
+    SDL_assert_release(result == VK_SUCCESS);
+    
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physDevice, &properties);
+    
+    PipelineCacheFileHeader header = {};
+    header.magic = pipelineCacheFileMagic;
+    header.dataSize = (uint32_t)dataSize;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    
+    // A missing cache only costs startup time, so failing to write it isn't fatal
+    FILE *file = fopen(pipelineCacheFilePath, "wb");
+    if (file == nullptr) {
+      printf("Couldn't write pipeline cache %s\n", pipelineCacheFilePath);
+      return;
+    }
     
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data.data(), dataSize, 1, file);
+    fclose(file);
+    
+    printf("Saved %i bytes of pipeline cache\n", (int)dataSize);
+  }
+  
   void submitCommandBuffer(VkCommandBuffer cmdBuffer, VkSemaphore optionalWaitSemaphore, VkPipelineStageFlags optionalWaitStage, VkSemaphore optionalSignalSemaphore, VkFence optionalFence) {
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -49,7 +152,7 @@ namespace gfx {
     SDL_assert(result == VK_SUCCESS);
   }
   
-  static void cmdTransitionImageLayout(VkCommandBuffer cmdBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
+  static void cmdTransitionImageLayout(VkCommandBuffer cmdBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, VkImageAspectFlags aspectMask) {
     VkImageMemoryBarrier barrier = {};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     
@@ -60,12 +163,12 @@ namespace gfx {
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.aspectMask = aspectMask;
     
     barrier.subresourceRange.baseMipLevel = 0;
     barrier.subresourceRange.levelCount = 1;
     barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.layerCount = layerCount;
     
     VkPipelineStageFlags srcStage = 0;
     VkPipelineStageFlags dstStage = 0;
@@ -80,50 +183,25 @@ namespace gfx {
       barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
       srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
       dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+      // Used for render targets whose render passes expect to start and finish in this layout
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     } else SDL_assert_release(false); // Unsupported layout transition
     
     vkCmdPipelineBarrier(cmdBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
   }
   
-  static void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
-    
-    // Create, fill, and submit the command buffer
-    auto cmdBuffer = createCommandBuffer();
-    
-    beginCommandBuffer(cmdBuffer);
-    
-    cmdTransitionImageLayout(cmdBuffer, image, oldLayout, newLayout);
-    
-    vkEndCommandBuffer(cmdBuffer);
-    
-    submitCommandBuffer(cmdBuffer);
-    
-    // Clean up
-    vkQueueWaitIdle(queue);
-    vkFreeCommandBuffers(device, commandPool, 1, &cmdBuffer);
-  }
-  
-  static void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-    
-    VkBufferImageCopy copyCmdInfo = {};
-    copyCmdInfo.bufferOffset = 0;
-    copyCmdInfo.bufferRowLength = 0;
-    copyCmdInfo.bufferImageHeight = 0;
-
-    copyCmdInfo.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copyCmdInfo.imageSubresource.mipLevel = 0;
-    copyCmdInfo.imageSubresource.baseArrayLayer = 0;
-    copyCmdInfo.imageSubresource.layerCount = 1;
-
-    copyCmdInfo.imageOffset = {0, 0, 0};
-    copyCmdInfo.imageExtent = {width, height, 1};
+  void transitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t layerCount, VkImageAspectFlags aspectMask) {
     
     // Create, fill, and submit the command buffer
     auto cmdBuffer = createCommandBuffer();
     
     beginCommandBuffer(cmdBuffer);
     
-    vkCmdCopyBufferToImage(cmdBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyCmdInfo);
+    cmdTransitionImageLayout(cmdBuffer, image, oldLayout, newLayout, layerCount, aspectMask);
     
     vkEndCommandBuffer(cmdBuffer);
     
@@ -134,39 +212,18 @@ namespace gfx {
     vkFreeCommandBuffers(device, commandPool, 1, &cmdBuffer);
   }
   
-  void setBufferMemory(VkDeviceMemory memory, uint64_t dataSize, const void *data) {
-    uint8_t *mappedMemory;
-    auto result = vkMapMemory(device, memory, 0, dataSize, 0, (void**)&mappedMemory);
-    SDL_assert(result == VK_SUCCESS);
-        
-    memcpy(mappedMemory, data, dataSize);
+  void setBufferMemory(const MemoryAllocation &memory, uint64_t dataSize, const void *data) {
+    // The arena keeps host-visible blocks persistently mapped, so this is just a copy.
+    SDL_assert(memory.mapped != nullptr);
+    SDL_assert(dataSize <= memory.size);
     
-    vkUnmapMemory(device, memory);
+    memcpy(memory.mapped, data, dataSize);
   }
   
-  void setImageMemoryRGBA(VkImage image, VkDeviceMemory memory, uint32_t width, uint32_t height, const uint8_t *data) {
-    
-    uint64_t dataSizePerPixel = sizeof(uint8_t) * 4; // R+G+B+A
-    uint64_t dataSizeTotal = dataSizePerPixel * width * height;
-    
-    // Create and fill a staging buffer with the image data
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, dataSizeTotal, &stagingBuffer, &stagingBufferMemory);
-    setBufferMemory(stagingBufferMemory, dataSizeTotal, data);
-    
-    // Let the GPU optimise the image for receiving buffer data
-    transitionImageLayout(image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    
-    // Copy the image data from the buffer to the image
-    copyBufferToImage(stagingBuffer, image, width, height);
-    
-    // Let the GPU optimise the image for shader access
-    transitionImageLayout(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    
-    // Clean up
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+  // Queued on the staging upload queue, so the image is only ready for use after the next flushUploads()
+  void setImageMemoryRGBA(VkImage image, uint32_t width, uint32_t height, const uint8_t *data, uint32_t mipLevels) {
+    uint32_t dataSizePerPixel = sizeof(uint8_t) * 4; // R+G+B+A
+    uploadImageData(image, width, height, dataSizePerPixel, data, mipLevels);
   }
   
   void beginCommandBuffer(VkCommandBuffer cmdBuffer) {
@@ -213,6 +270,27 @@ namespace gfx {
     vkCmdBeginRenderPass(cmdBuffer, &info, VK_SUBPASS_CONTENTS_INLINE);
   }
   
+  // For render passes whose only attachment is a depth attachment, which is cleared to the far plane.
+  void cmdBeginDepthOnlyRenderPass(VkRenderPass renderPass, uint32_t width, uint32_t height, VkFramebuffer framebuffer, VkCommandBuffer cmdBuffer) {
+    VkRenderPassBeginInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    info.renderPass = renderPass;
+    info.framebuffer = framebuffer;
+    
+    VkClearValue clearValue = {};
+    clearValue.depthStencil.depth = 1;
+    clearValue.depthStencil.stencil = 0;
+    
+    info.clearValueCount = 1;
+    info.pClearValues = &clearValue;
+    
+    info.renderArea.offset = { 0, 0 };
+    info.renderArea.extent.width = width;
+    info.renderArea.extent.height = height;
+    
+    vkCmdBeginRenderPass(cmdBuffer, &info, VK_SUBPASS_CONTENTS_INLINE);
+  }
+  
   void presentFrame(const SwapchainFrame *frame, VkSemaphore waitSemaphore) {
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -4,6 +4,7 @@
 #include "imgui_impl_vulkan.h"
 #include "graphics.h"
 #include "settings.h"
+#include "deferred.h"
 #include "shadows.h"
 
 namespace gui {
@@ -48,12 +49,13 @@ namespace gui {
     initInfo.Device = gfx::device;
     initInfo.QueueFamily = gfx::queueFamilyIndex;
     initInfo.Queue = gfx::queue;
-    initInfo.PipelineCache = VK_NULL_HANDLE;
+    initInfo.PipelineCache = gfx::pipelineCache;
     initInfo.MSAASamples = MSAA_SETTING;
     initInfo.DescriptorPool = gfx::descriptorPool;
     initInfo.Allocator = nullptr;
     initInfo.MinImageCount = gfx::swapchainSize;
-    initInfo.ImageCount = gfx::swapchainSize;
+    // ImGui cycles through ImageCount vertex buffers, so it needs at least one per frame in flight.
+    initInfo.ImageCount = FRAMES_IN_FLIGHT > gfx::swapchainSize ? FRAMES_IN_FLIGHT : gfx::swapchainSize;
     initInfo.CheckVkResultFn = nullptr;
     ImGui_ImplVulkan_Init(&initInfo, gfx::renderPass);
     
@@ -73,11 +75,29 @@ namespace gui {
     
     Begin("Lighting Settings");
     
+    Text("%.2f ms/frame (%.0f FPS)", 1000.0f / GetIO().Framerate, GetIO().Framerate);
+    
     Checkbox("Animate Lightsource", &settings.animateLightPos);
     
     SetNextItemWidth(90);
     SliderFloat("Ambient Lighting Amount", &settings.ambReflection, 0, 1, "%.3f", 2);
     
+    Text("Light Type");
+    if (RadioButton("Point", settings.lightType == settings.POINT)) {
+      settings.lightType = settings.POINT;
+    }
+    if (RadioButton("Directional (Cascaded)", settings.lightType == settings.DIRECTIONAL)) {
+      settings.lightType = settings.DIRECTIONAL;
+    }
+    
+    Text("Soft Shadows");
+    if (RadioButton("Multiple Subsources", settings.softShadowMode == settings.SUBSOURCES)) {
+      settings.softShadowMode = settings.SUBSOURCES;
+    }
+    if (RadioButton("PCSS", settings.softShadowMode == settings.PCSS)) {
+      settings.softShadowMode = settings.PCSS;
+    }
+    
     Text("Subsource Arrangement");
     if (RadioButton("Spiral", settings.subsourceArrangement == settings.SPIRAL)) {
       settings.subsourceArrangement = settings.SPIRAL;
@@ -102,6 +122,34 @@ namespace gui {
     if (settings.shadowAntiAliasSize < 0) settings.shadowAntiAliasSize = 0;
     // if (settings.shadowAntiAliasSize != 0 && settings.shadowAntiAliasSize % 2 == 0) settings.shadowAntiAliasSize -= 1;
     
+    Text("Shadow Filter");
+    if (RadioButton("Square", settings.shadowFilterMode == settings.SQUARE_PCF)) {
+      settings.shadowFilterMode = settings.SQUARE_PCF;
+    }
+    if (RadioButton("Rotated Poisson Disc", settings.shadowFilterMode == settings.POISSON_PCF)) {
+      settings.shadowFilterMode = settings.POISSON_PCF;
+    }
+    if (RadioButton("Blue Noise Disc", settings.shadowFilterMode == settings.BLUE_NOISE_PCF)) {
+      settings.shadowFilterMode = settings.BLUE_NOISE_PCF;
+    }
+    if (RadioButton("Gather", settings.shadowFilterMode == settings.GATHER_PCF)) {
+      settings.shadowFilterMode = settings.GATHER_PCF;
+    }
+    if (RadioButton("Variance (VSM)", settings.shadowFilterMode == settings.VSM)) {
+      settings.shadowFilterMode = settings.VSM;
+    }
+    if (RadioButton("Exponential (ESM)", settings.shadowFilterMode == settings.ESM)) {
+      settings.shadowFilterMode = settings.ESM;
+    }
+    
+    // PCSS uses the tap count for both its blocker search and its filter
+    if (settings.shadowFilterMode == settings.POISSON_PCF || settings.shadowFilterMode == settings.BLUE_NOISE_PCF || settings.softShadowMode == settings.PCSS) {
+      SetNextItemWidth(90);
+      InputInt("Shadow Filter Taps", &settings.shadowFilterTapCount);
+      if (settings.shadowFilterTapCount > MAX_SHADOW_FILTER_TAP_COUNT) settings.shadowFilterTapCount = MAX_SHADOW_FILTER_TAP_COUNT;
+      if (settings.shadowFilterTapCount < 1) settings.shadowFilterTapCount = 1;
+    }
+    
     vector<ImVec2> imVecs;
     for (auto &offset : shadows::getViewOffsets()) {
         float radius = settings.sourceRadius;
@@ -114,6 +162,19 @@ namespace gui {
     Checkbox("Textures", &settings.renderTextures);
     Checkbox("Normalmapped floorboards", &settings.renderNormalMaps);
     
+    Text("Shading Path");
+    if (RadioButton("Forward", settings.shadingPath == settings.FORWARD)) {
+      settings.shadingPath = settings.FORWARD;
+    }
+    if (deferred::supported && RadioButton("Deferred", settings.shadingPath == settings.DEFERRED)) {
+      settings.shadingPath = settings.DEFERRED;
+    }
+    
+    // The deferred lighting pass already shades only the visible surfaces
+    if (settings.shadingPath == settings.FORWARD) {
+      Checkbox("Depth pre-pass", &settings.depthPrePass);
+    }
+    
     End();
     
     Render();
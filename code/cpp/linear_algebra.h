@@ -9,4 +9,31 @@
 #include <glm/gtx/rotate_vector.hpp>
 using namespace glm;
 
-#define M_TAU (2*M_PI)
\ No newline at end of file
+#define M_TAU (2*M_PI)
+
+// A view frustum as six inward-facing planes, each a unit normal in xyz and a distance in w. Taken from a view-projection matrix with [0,1] depth.
+struct Frustum {
+  vec4 planes[6];
+  
+  Frustum(const mat4 &viewProj) {
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++) rows[i] = vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+    
+    planes[0] = rows[3] + rows[0]; // Left
+    planes[1] = rows[3] - rows[0]; // Right
+    planes[2] = rows[3] + rows[1]; // Bottom
+    planes[3] = rows[3] - rows[1]; // Top
+    planes[4] = rows[2];           // Near
+    planes[5] = rows[3] - rows[2]; // Far
+    
+    for (auto &plane : planes) plane /= length(vec3(plane));
+  }
+  
+  // Conservative: a sphere just outside a corner can still pass
+  bool intersectsSphere(vec3 centre, float radius) const {
+    for (auto &plane : planes) {
+      if (dot(vec3(plane), centre) + plane.w < -radius) return false;
+    }
+    return true;
+  }
+};
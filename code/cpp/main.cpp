@@ -1,16 +1,26 @@
 #ifdef __APPLE__
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #else
 #include <direct.h>
 #define chdir _chdir
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #endif
 
 #include <string>
 #include <fstream>
+#include <thread>
+#include <atomic>
 
 #include "main.h"
 #include "input.h"
 #include "shadowMapViewer.h"
+#include "shadowMoments.h"
+#include "deferred.h"
 #include "graphics.h"
 #include "ShadowMap.h"
 #include "presentation.h"
@@ -49,47 +59,130 @@ vector<uint8_t> loadBinaryFile(const char *filename) {
   return bytes;
 }
 
-vector<ShadowMap> shadowMaps;
+// 64-bit FNV-1a
+uint64_t hashBytes(const uint8_t *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
 
-VkSemaphore imageAvailableSemaphore  = VK_NULL_HANDLE;
-VkSemaphore renderCompletedSemaphore = VK_NULL_HANDLE;
+bool mapBinaryFile(const char *filename, MappedFile *fileOut) {
+  *fileOut = MappedFile();
+  
+#ifdef __APPLE__
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+  
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  
+  void *data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps the file open
+  if (data == MAP_FAILED) return false;
+  
+  fileOut->data = (const uint8_t*)data;
+  fileOut->size = fileStat.st_size;
+#else
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file); // The mapping keeps the file open
+  if (mapping == nullptr) return false;
+  
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == nullptr) {
+    CloseHandle(mapping);
+    return false;
+  }
+  
+  fileOut->data = (const uint8_t*)data;
+  fileOut->size = (size_t)fileSize.QuadPart;
+  fileOut->handle = mapping;
+#endif
+  
+  printf("MAPPED: %s\n", filename);
+  return true;
+}
 
-void createSemaphores() {
-  VkSemaphoreCreateInfo semaphoreInfo = {};
-  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  vkCreateSemaphore(gfx::device, &semaphoreInfo, nullptr, &imageAvailableSemaphore);
-  SDL_assert_release(vkCreateSemaphore(gfx::device, &semaphoreInfo, nullptr, &renderCompletedSemaphore) == VK_SUCCESS);
+void unmapBinaryFile(MappedFile *file) {
+  if (file->data == nullptr) return;
+  
+#ifdef __APPLE__
+  munmap((void*)file->data, file->size);
+#else
+  UnmapViewOfFile(file->data);
+  CloseHandle((HANDLE)file->handle);
+#endif
+  
+  *file = MappedFile();
+}
+
+// Runs the jobs on a pool of worker threads, one per core, which each take the next unstarted job until there are none left.
+void runInParallel(const vector<function<void()>> &jobs) {
+  atomic<size_t> nextJob(0);
+  auto worker = [&]() {
+    for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) jobs[i]();
+  };
+  
+  size_t threadCount = std::min((size_t)std::max(thread::hardware_concurrency(), 1u), jobs.size());
+  
+  // The calling thread is one of the workers
+  vector<thread> threads;
+  for (size_t i = 1; i < threadCount; i++) threads.push_back(thread(worker));
+  worker();
+  
+  for (auto &t : threads) t.join();
 }
 
+ShadowMap *shadowMap = nullptr;
+
 void renderNextFrame(float deltaTime) {
   presentation::update(deltaTime);
   shadows::update();
   
-  gfx::SwapchainFrame *frame = gfx::getNextFrame(imageAvailableSemaphore);
+  // Blocks only if the GPU is still FRAMES_IN_FLIGHT frames behind, instead of waiting for the queue to go idle every frame.
+  gfx::FrameInFlight *inFlight = gfx::getNextFrameInFlight();
+  gfx::SwapchainFrame *frame = gfx::getNextFrame(inFlight);
+  
+  gfx::beginCommandBuffer(inFlight->cmdBuffer);
   
-  // Wait for the command buffer to finish executing
-  vkQueueWaitIdle(gfx::queue);
+  shadows::performRenderPasses(inFlight->cmdBuffer);
+  shadowMoments::performRenderPasses(inFlight->cmdBuffer, shadows::getSubsourceCount());
   
-  gfx::beginCommandBuffer(frame->cmdBuffer);
+  presentation::performGBufferPass(inFlight->cmdBuffer, shadowMap);
   
-  shadows::performRenderPasses(frame->cmdBuffer);
+  // When shading is deferred, the main render pass keeps the depth from the G-buffer pass
+  VkRenderPass mainRenderPass = settings.shadingPath == settings.DEFERRED ? gfx::deferredRenderPass : gfx::renderPass;
   
   auto extent = gfx::getSurfaceExtent();
   vec3 clearColor = {0.5, 0.7, 1};
-  gfx::cmdBeginRenderPass(gfx::renderPass, extent.width, extent.height, clearColor, frame->framebuffer, frame->cmdBuffer);
-  presentation::render(frame->cmdBuffer, &shadowMaps);
+  gfx::cmdBeginRenderPass(mainRenderPass, extent.width, extent.height, clearColor, frame->framebuffer, inFlight->cmdBuffer);
+  presentation::render(inFlight->cmdBuffer, shadowMap);
   
-  gui::render(frame->cmdBuffer);
-  vkCmdEndRenderPass(frame->cmdBuffer);
+  gui::render(inFlight->cmdBuffer);
+  vkCmdEndRenderPass(inFlight->cmdBuffer);
   
-  auto result = vkEndCommandBuffer(frame->cmdBuffer);
+  auto result = vkEndCommandBuffer(inFlight->cmdBuffer);
   SDL_assert(result == VK_SUCCESS);
   
   // Submit the command buffer
   VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  gfx::submitCommandBuffer(frame->cmdBuffer, imageAvailableSemaphore, waitStage, renderCompletedSemaphore, VK_NULL_HANDLE);
+  gfx::submitCommandBuffer(inFlight->cmdBuffer, inFlight->imageAvailableSemaphore, waitStage, inFlight->renderCompletedSemaphore, inFlight->fence);
   
-  gfx::presentFrame(frame, renderCompletedSemaphore);
+  gfx::presentFrame(frame, inFlight->renderCompletedSemaphore);
 }
 
 int main(int argc, char* argv[]) {
@@ -107,6 +200,9 @@ int main(int argc, char* argv[]) {
   printf("main()\n");
   fflush(stdout);
   
+  // Starts the clock, for measuring the time to the first frame
+  double launchTime = getTime();
+  
   int result = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_EVENTS);
   SDL_assert_release(result == 0);
   
@@ -129,16 +225,22 @@ int main(int argc, char* argv[]) {
   fflush(stdout);
   
   gfx::createCoreHandles(window);
-  createSemaphores();
   
-  for (int i = 0; i < MAX_LIGHT_SUBSOURCE_COUNT; i++) shadowMaps.push_back(ShadowMap(SHADOWMAP_RESOLUTION, SHADOWMAP_RESOLUTION));
+  shadowMap = new ShadowMap(SHADOWMAP_RESOLUTION, SHADOWMAP_RESOLUTION, MAX_LIGHT_SUBSOURCE_COUNT);
   
   geometry::init();
-  shadows::init(&shadowMaps);
+  shadows::init(shadowMap);
+  shadowMoments::init(shadowMap);
+  deferred::init();
   presentation::init();
-  shadowMapViewer::init(&shadowMaps);
+  shadowMapViewer::init(shadowMap);
   gui::init(window);
   
+  // Send all the geometry and textures created above to the GPU in one go
+  gfx::flushUploads();
+  
+  gfx::printMemoryStats();
+  
   bool running = true;
   
   printf("Beginning frame loop\n");
@@ -179,10 +281,21 @@ int main(int argc, char* argv[]) {
     
     renderNextFrame(deltaTime);
     
+    // Comparing runs with and without a saved pipeline cache shows what pipeline compilation costs at startup
+    static bool firstFrame = true;
+    if (firstFrame) {
+      printf("Time to first frame: %.0f ms (%s pipeline cache)\n", (getTime() - launchTime) * 1000, gfx::pipelineCacheWasLoaded ? "with" : "without");
+      firstFrame = false;
+    }
+    
     fflush(stdout);
   }
   
   printf("Quitting\n");
+  
+  // Lets the next launch skip compiling the pipelines
+  gfx::savePipelineCache();
+  
   SDL_Quit();
   return 0;
 }
@@ -5,10 +5,23 @@
 #pragma warning( disable : 4305 )
 
 #include <vector>
+#include <functional>
 using namespace std;
 
 vector<uint8_t> loadBinaryFile(const char *filename);
+
+// A read-only view of a whole file, mapped into memory rather than copied
+struct MappedFile {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  void *handle = nullptr; // Platform-specific
+};
+
+bool mapBinaryFile(const char *filename, MappedFile *fileOut); // Returns false if the file doesn't exist or is empty
+void unmapBinaryFile(MappedFile *file);
 double getTime();
+uint64_t hashBytes(const uint8_t *data, size_t size);
+void runInParallel(const vector<function<void()>> &jobs); // Returns once every job has finished
 
 
 
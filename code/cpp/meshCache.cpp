@@ -0,0 +1,70 @@
+#include "meshCache.h"
+
+namespace meshCache {
+  
+  string getCachePath(const char *sourcePath) {
+    string path = sourcePath;
+    size_t dot = path.find_last_of('.');
+    if (dot != string::npos) path.erase(dot);
+    return path + ".mesh";
+  }
+  
+  // A corrupt layout mustn't send the draw call's buffer bindings past the end of the data, so every region has to fit in it
+  static bool isLayoutInBounds(const DrawCall::VertexBufferLayout &layout) {
+    uint64_t indexSize;
+    if (layout.indexType == VK_INDEX_TYPE_UINT16) indexSize = 2;
+    else if (layout.indexType == VK_INDEX_TYPE_UINT32) indexSize = 4;
+    else return false;
+    
+    // Positions, then attributes, then indices. The counts are 32-bit, so the 64-bit products can't overflow.
+    return (uint64_t)layout.vertexCount * DrawCall::positionSize <= layout.attributesOffset
+      && layout.attributesOffset <= layout.indicesOffset
+      && (uint64_t)layout.vertexCount * DrawCall::attributesSize <= layout.indicesOffset - layout.attributesOffset
+      && layout.indicesOffset % indexSize == 0
+      && layout.indicesOffset <= layout.size
+      && layout.indexCount * indexSize <= layout.size - layout.indicesOffset;
+  }
+  
+  bool map(const char *cachePath, uint64_t sourceHash, MappedFile *fileOut, const DrawCall::VertexBufferLayout **layoutOut, const uint8_t **dataOut) {
+    if (!mapBinaryFile(cachePath, fileOut)) return false;
+    
+    // Anything stale or unexpected is ignored, and rewritten by the caller
+    auto header = (const Header*)fileOut->data;
+    bool valid = fileOut->size >= sizeof(Header)
+      && header->magic == magic
+      && header->version == version
+      && header->sourceHash == sourceHash
+      && header->layout.positionFormat == DrawCall::positionFormat
+      && fileOut->size == sizeof(Header) + header->layout.size
+      && isLayoutInBounds(header->layout);
+    
+    if (!valid) {
+      printf("Mesh cache %s is out of date\n", cachePath);
+      unmapBinaryFile(fileOut);
+      return false;
+    }
+    
+    *layoutOut = &header->layout;
+    *dataOut = fileOut->data + sizeof(Header);
+    return true;
+  }
+  
+  void write(const char *cachePath, uint64_t sourceHash, const DrawCall::VertexBufferLayout &layout, const uint8_t *data) {
+    Header header = {};
+    header.magic = magic;
+    header.version = version;
+    header.sourceHash = sourceHash;
+    header.layout = layout;
+    
+    // Not being able to write the cache only costs load time, e.g. if the assets are read-only
+    FILE *file = fopen(cachePath, "wb");
+    if (file == nullptr) {
+      printf("Couldn't write mesh cache %s\n", cachePath);
+      return;
+    }
+    
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data, layout.size, 1, file);
+    fclose(file);
+  }
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "main.h"
+#include "DrawCall.h"
+#include <string>
+using namespace std;
+
+// Binary copies of parsed and packed meshes, so that source files like OBJs only have to be parsed once. A cache file holds a Header followed by the DrawCall's packed vertex buffer, byte for byte, which lets it be memory-mapped and handed straight to the upload queue.
+namespace meshCache {
+  const uint32_t magic = 0x4853454D; // "MESH"
+  const uint32_t version = 1; // Bump when DrawCall::packVertexBuffer() changes its output
+  
+  struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash; // hashBytes() of the source file the mesh was parsed from
+    DrawCall::VertexBufferLayout layout;
+  };
+  
+  // "aeroplane.obj" -> "aeroplane.mesh"
+  string getCachePath(const char *sourcePath);
+  
+  // Maps a cache file, if there is one that matches the source hash and the current vertex formats. layoutOut and dataOut point into fileOut, so they're valid until it's unmapped.
+  bool map(const char *cachePath, uint64_t sourceHash, MappedFile *fileOut, const DrawCall::VertexBufferLayout **layoutOut, const uint8_t **dataOut);
+  
+  void write(const char *cachePath, uint64_t sourceHash, const DrawCall::VertexBufferLayout &layout, const uint8_t *data);
+}
@@ -5,14 +5,17 @@
 #include "shadows.h"
 #include "geometry.h"
 #include "settings.h"
+#include "deferred.h"
+#include <map>
+#include <cstddef>
 
 namespace presentation {
   
   VkPipelineLayout basicPipelineLayout    = VK_NULL_HANDLE;
   VkPipelineLayout texturedPipelineLayout = VK_NULL_HANDLE;
-  VkPipeline       litPipeline            = VK_NULL_HANDLE;
-  VkPipeline       litTexturedPipeline    = VK_NULL_HANDLE;
+  VkPipelineLayout deferredPipelineLayout = VK_NULL_HANDLE;
   VkPipeline       unlitPipeline          = VK_NULL_HANDLE;
+  VkPipeline       depthPrePassPipeline   = VK_NULL_HANDLE;
   
   vec3 cameraPos;
   vec2 cameraAngle;
@@ -22,6 +25,11 @@ namespace presentation {
   struct {
     mat4 view;
     mat4 proj;
+    
+    // For the deferred lighting pass, which reconstructs positions from depth
+    mat4 inverseView;
+    mat4 inverseProj;
+    vec4 lightPosInView; // Saves the lighting pass inverting the light's view matrix for every pixel
   } matrices;
   
   struct PushConstants {
@@ -30,15 +38,166 @@ namespace presentation {
     uint32_t renderTexturesBool;
     uint32_t renderNormalMapsBool;
     float ambReflection;
+    int32_t shadowFilterMode;
+    int32_t shadowFilterTapCount;
+    uint32_t pcssBool;
+    float lightRadius;
+    float momentsDistanceRange;
   } pushConstants;
   
-  VkBuffer              matricesBuffer        = VK_NULL_HANDLE;
-  VkDeviceMemory        matricesBufferMemory  = VK_NULL_HANDLE;
-  VkDescriptorSet       matricesDescSet       = VK_NULL_HANDLE;
+  VkDescriptorSet       matricesDescSet         = VK_NULL_HANDLE;
+  
+  // Settings baked into lit.frag and litTextured.frag as specialization constants. Each combination gets its own pipeline.
+  struct ShaderVariant {
+    int32_t subsourceCount;
+    int32_t shadowAntiAliasSize;
+    VkBool32 renderTexture;
+    VkBool32 renderNormalMap;
+  };
+  
+  // Entry i sets constant_id i
+  static const VkSpecializationMapEntry shaderVariantEntries[] = {
+    {0, offsetof(ShaderVariant, subsourceCount),      sizeof(int32_t)},
+    {1, offsetof(ShaderVariant, shadowAntiAliasSize), sizeof(int32_t)},
+    {2, offsetof(ShaderVariant, renderTexture),       sizeof(VkBool32)},
+    {3, offsetof(ShaderVariant, renderNormalMap),     sizeof(VkBool32)},
+  };
+  
+  struct LitPipelineKey {
+    bool textured;
+    ShaderVariant variant;
+    bool depthPrePass; // Test for EQUAL depth without writing it, as the pre-pass already has
+    bool gBuffer; // Write the surface attributes to the G-buffer instead of shading
+  };
+  
+  // Lit and litTextured pipeline variants, created on first use
+  static map<uint32_t, VkPipeline> litPipelines;
+  
+  static uint32_t getLitPipelineHash(const LitPipelineKey &key) {
+    return key.variant.subsourceCount | key.variant.shadowAntiAliasSize << 8 | key.variant.renderTexture << 16 | key.variant.renderNormalMap << 17 | (uint32_t)key.textured << 18 | (uint32_t)key.depthPrePass << 19 | (uint32_t)key.gBuffer << 20;
+  }
+  
+  // Clears whatever the key's shaders ignore, so that it doesn't make duplicate variants
+  static LitPipelineKey getCanonicalKey(LitPipelineKey key) {
+    
+    // lit.frag and gBuffer.frag have no texture toggles
+    if (!key.textured) key.variant.renderTexture = key.variant.renderNormalMap = VK_FALSE;
+    
+    // The G-buffer shaders don't sample the shadowmaps, and there's no pre-pass before them
+    if (key.gBuffer) {
+      key.variant.subsourceCount = key.variant.shadowAntiAliasSize = 0;
+      key.depthPrePass = false;
+    }
+    
+    return key;
+  }
+  
+  static VkSpecializationInfo getSpecializationInfo(const ShaderVariant *variant) {
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = sizeof(shaderVariantEntries) / sizeof(shaderVariantEntries[0]);
+    specializationInfo.pMapEntries = shaderVariantEntries;
+    specializationInfo.dataSize = sizeof(ShaderVariant);
+    specializationInfo.pData = variant;
+    return specializationInfo;
+  }
+  
+  static ShaderVariant getCurrentShaderVariant() {
+    ShaderVariant variant;
+    variant.subsourceCount = shadows::getSubsourceCount();
+    variant.shadowAntiAliasSize = settings.shadowAntiAliasSize;
+    variant.renderTexture = settings.renderTextures;
+    variant.renderNormalMap = settings.renderNormalMaps;
+    return variant;
+  }
+  
+  // Creates whichever of the requested variants don't exist yet, in a single gfx::createPipelines() batch
+  static void createLitPipelines(vector<LitPipelineKey> keys) {
+    vector<LitPipelineKey> newKeys;
+    for (auto &key : keys) {
+      key = getCanonicalKey(key);
+      
+      bool isNew = litPipelines.count(getLitPipelineHash(key)) == 0;
+      for (auto &newKey : newKeys) {
+        if (getLitPipelineHash(newKey) == getLitPipelineHash(key)) isNew = false;
+      }
+      
+      if (isNew) newKeys.push_back(key);
+    }
+    
+    if (newKeys.empty()) return;
+    
+    vector<VkSpecializationInfo> specializationInfos(newKeys.size());
+    vector<gfx::PipelineDesc> descs(newKeys.size());
+    
+    for (size_t i = 0; i < newKeys.size(); i++) {
+      specializationInfos[i] = getSpecializationInfo(&newKeys[i].variant);
+      
+      gfx::PipelineDesc &desc = descs[i];
+      desc.layout = newKeys[i].textured ? texturedPipelineLayout : basicPipelineLayout;
+      desc.vertexAttribFormats = DrawCall::getVertexStreamFormats(false);
+      desc.extent = gfx::getSurfaceExtent();
+      desc.renderPass = gfx::renderPass;
+      desc.cullMode = VK_CULL_MODE_BACK_BIT;
+      desc.vertexShaderPath = newKeys[i].textured ? "litTextured.vert.spv" : "lit.vert.spv";
+      desc.fragmentShaderPath = newKeys[i].textured ? "litTextured.frag.spv" : "lit.frag.spv";
+      desc.sampleCountFlag = MSAA_SETTING;
+      desc.specializationInfo = &specializationInfos[i];
+      
+      // The G-buffer pipelines share the vertex shaders, but their fragment shaders only write the surface attributes
+      if (newKeys[i].gBuffer) {
+        desc.renderPass = deferred::gBufferRenderPass;
+        desc.fragmentShaderPath = newKeys[i].textured ? "gBufferTextured.frag.spv" : "gBuffer.frag.spv";
+        desc.colorAttachmentCount = 2;
+      }
+      
+      if (newKeys[i].depthPrePass) {
+        desc.depthWrite = VK_FALSE;
+        desc.depthCompareOp = VK_COMPARE_OP_EQUAL;
+      }
+    }
+    
+    auto pipelines = gfx::createPipelines(descs);
+    for (size_t i = 0; i < newKeys.size(); i++) litPipelines[getLitPipelineHash(newKeys[i])] = pipelines[i];
+    
+    printf("Created %i lit pipeline variants (%i in total)\n", (int)newKeys.size(), (int)litPipelines.size());
+  }
+  
+  static VkPipeline getLitPipeline(const LitPipelineKey &key) {
+    createLitPipelines({key});
+    return litPipelines[getLitPipelineHash(getCanonicalKey(key))];
+  }
   
-  VkBuffer              lightViewOffsetsBuffer        = VK_NULL_HANDLE;
-  VkDeviceMemory        lightViewOffsetsBufferMemory  = VK_NULL_HANDLE;
-  VkDescriptorSet       lightViewOffsetsDescSet       = VK_NULL_HANDLE;
+  // Deferred lighting pipeline variants, created on first use. Only the shadow constants of the variant apply to them.
+  static map<uint32_t, VkPipeline> deferredLightingPipelines;
+  
+  static VkPipeline getDeferredLightingPipeline(ShaderVariant variant) {
+    variant.renderTexture = variant.renderNormalMap = VK_FALSE;
+    
+    uint32_t hash = getLitPipelineHash({false, variant, false, false});
+    if (deferredLightingPipelines.count(hash)) return deferredLightingPipelines[hash];
+    
+    VkSpecializationInfo specializationInfo = getSpecializationInfo(&variant);
+    
+    // A single fullscreen triangle, so there are no vertex attributes. It's drawn in gfx::deferredRenderPass, which is compatible with gfx::renderPass but has a read only depth attachment.
+    gfx::PipelineDesc desc;
+    desc.layout = deferredPipelineLayout;
+    desc.extent = gfx::getSurfaceExtent();
+    desc.renderPass = gfx::renderPass;
+    desc.cullMode = VK_CULL_MODE_NONE;
+    desc.vertexShaderPath = "fullscreen.vert.spv";
+    desc.fragmentShaderPath = "deferredLighting.frag.spv";
+    desc.sampleCountFlag = MSAA_SETTING;
+    desc.specializationInfo = &specializationInfo;
+    desc.depthWrite = VK_FALSE;
+    desc.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+    desc.blendEnable = VK_TRUE; // Blends over the clear color where some of a pixel's samples are empty
+    
+    VkPipeline pipeline = gfx::createPipelines({desc})[0];
+    deferredLightingPipelines[hash] = pipeline;
+    
+    printf("Created a deferred lighting pipeline variant (%i in total)\n", (int)deferredLightingPipelines.size());
+    return pipeline;
+  }
   
   static mat4 createProjectionMatrix(uint32_t width, uint32_t height, float fieldOfView) {
     float aspectRatio = width / (float)height;
@@ -49,41 +208,31 @@ namespace presentation {
   }
 
   void init() {
-    gfx::createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(matrices), &matricesBuffer, &matricesBufferMemory);
-    matricesDescSet = gfx::createDescSet(matricesBuffer);
-    gfx::createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(vec2) * MAX_LIGHT_SUBSOURCE_COUNT, &lightViewOffsetsBuffer, &lightViewOffsetsBufferMemory);
-    lightViewOffsetsDescSet = gfx::createDescSet(lightViewOffsetsBuffer);
+    matricesDescSet = gfx::getUniformRingDescSet(sizeof(matrices));
     
     vector<VkDescriptorSetLayout> descriptorSetLayouts = {
-      gfx::bufferDescLayout, // drawcall world matrix
-      gfx::bufferDescLayout, // shadow matrices
-      gfx::bufferDescLayout, // camera matrices
-      gfx::bufferDescLayout, // light view offsets
+      gfx::dynamicBufferDescLayout, // drawcall world matrix
+      gfx::dynamicBufferDescLayout, // shadow matrices
+      gfx::dynamicBufferDescLayout, // camera matrices
+      gfx::dynamicBufferDescLayout, // shadow layers (light view offsets and cascades)
+      gfx::samplerDescLayout,       // shadowmap array
+      gfx::samplerDescLayout,       // shadowmap array depths
+      gfx::samplerDescLayout,       // shadowmap array moments
     };
     
-    // Add layouts for shadowmaps
-    for (int i = 0; i < MAX_LIGHT_SUBSOURCE_COUNT; i++) {
-      descriptorSetLayouts.push_back(gfx::samplerDescLayout);
-    }
-    
     basicPipelineLayout = gfx::createPipelineLayout(descriptorSetLayouts.data(), (int)descriptorSetLayouts.size(), sizeof(PushConstants));
-    vector<VkFormat> vertAttribFormats = {VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT};
-    litPipeline = gfx::createPipeline(basicPipelineLayout, vertAttribFormats, gfx::getSurfaceExtent(), gfx::renderPass, VK_CULL_MODE_BACK_BIT, "lit.vert.spv", "lit.frag.spv", MSAA_SETTING);
-    unlitPipeline = gfx::createPipeline(basicPipelineLayout, vertAttribFormats, gfx::getSurfaceExtent(), gfx::renderPass, VK_CULL_MODE_BACK_BIT, "unlit.vert.spv", "unlit.frag.spv", MSAA_SETTING);
     
     {
       vector<VkDescriptorSetLayout> descriptorSetLayouts = {
-        gfx::bufferDescLayout, // drawcall world matrix
-        gfx::bufferDescLayout, // shadow matrices
-        gfx::bufferDescLayout, // camera matrices
-        gfx::bufferDescLayout, // light view offsets
+        gfx::dynamicBufferDescLayout, // drawcall world matrix
+        gfx::dynamicBufferDescLayout, // shadow matrices
+        gfx::dynamicBufferDescLayout, // camera matrices
+        gfx::dynamicBufferDescLayout, // shadow layers (light view offsets and cascades)
+        gfx::samplerDescLayout,       // shadowmap array
+        gfx::samplerDescLayout,       // shadowmap array depths
+        gfx::samplerDescLayout,       // shadowmap array moments
       };
       
-      // Add layouts for shadowmaps
-      for (int i = 0; i < MAX_LIGHT_SUBSOURCE_COUNT; i++) {
-        descriptorSetLayouts.push_back(gfx::samplerDescLayout);
-      }
-      
       // Add texture sampler layout
       descriptorSetLayouts.push_back(gfx::samplerDescLayout);
       
@@ -91,12 +240,75 @@ namespace presentation {
       descriptorSetLayouts.push_back(gfx::samplerDescLayout);
       
       texturedPipelineLayout = gfx::createPipelineLayout(descriptorSetLayouts.data(), (int)descriptorSetLayouts.size(), sizeof(PushConstants));
-      vector<VkFormat> vertAttribFormats = {VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32_SFLOAT};
-      litTexturedPipeline = gfx::createPipeline(texturedPipelineLayout, vertAttribFormats, gfx::getSurfaceExtent(), gfx::renderPass, VK_CULL_MODE_BACK_BIT, "litTextured.vert.spv", "litTextured.frag.spv", MSAA_SETTING);
+    }
+    
+    {
+      vector<VkDescriptorSetLayout> descriptorSetLayouts = {
+        gfx::dynamicBufferDescLayout, // drawcall world matrix
+        gfx::dynamicBufferDescLayout, // shadow matrices
+        gfx::dynamicBufferDescLayout, // camera matrices
+        gfx::dynamicBufferDescLayout, // shadow layers (light view offsets and cascades)
+        gfx::samplerDescLayout,       // shadowmap array
+        gfx::samplerDescLayout,       // shadowmap array depths
+        gfx::samplerDescLayout,       // shadowmap array moments
+      };
+      
+      // Add the G-buffer's albedo, normal and depth sampler layouts
+      descriptorSetLayouts.push_back(gfx::samplerDescLayout);
+      descriptorSetLayouts.push_back(gfx::samplerDescLayout);
+      descriptorSetLayouts.push_back(gfx::samplerDescLayout);
+      
+      deferredPipelineLayout = gfx::createPipelineLayout(descriptorSetLayouts.data(), (int)descriptorSetLayouts.size(), sizeof(PushConstants));
+    }
+    
+    // The light source is drawn last, so nothing needs its depth. Not writing it lets it test against the read only depth in gfx::deferredRenderPass too.
+    {
+      gfx::PipelineDesc desc;
+      desc.layout = basicPipelineLayout;
+      desc.vertexAttribFormats = DrawCall::getVertexStreamFormats(true);
+      desc.extent = gfx::getSurfaceExtent();
+      desc.renderPass = gfx::renderPass;
+      desc.cullMode = VK_CULL_MODE_BACK_BIT;
+      desc.vertexShaderPath = "unlit.vert.spv";
+      desc.fragmentShaderPath = "unlit.frag.spv";
+      desc.sampleCountFlag = MSAA_SETTING;
+      desc.depthWrite = VK_FALSE;
+      
+      unlitPipeline = gfx::createPipelines({desc})[0];
+    }
+    
+    // Depth only, in the main subpass ahead of the lit draws. It only reads the position stream.
+    {
+      gfx::PipelineDesc desc;
+      desc.layout = basicPipelineLayout;
+      desc.vertexAttribFormats = DrawCall::getVertexStreamFormats(true);
+      desc.extent = gfx::getSurfaceExtent();
+      desc.renderPass = gfx::renderPass;
+      desc.cullMode = VK_CULL_MODE_BACK_BIT;
+      desc.vertexShaderPath = "depthPrePass.vert.spv";
+      desc.fragmentShaderPath = nullptr;
+      desc.sampleCountFlag = MSAA_SETTING;
+      desc.keepColorAttachment = true;
+      
+      depthPrePassPipeline = gfx::createPipelines({desc})[0];
+    }
+    
+    // Compile the variants the current settings need up front. Changing the settings in the GUI creates any others the first time they're drawn.
+    {
+      ShaderVariant variant = getCurrentShaderVariant();
+      ShaderVariant variantWithoutNormalMap = variant;
+      variantWithoutNormalMap.renderNormalMap = VK_FALSE;
+      
+      bool depthPrePass = settings.depthPrePass;
+      bool gBuffer = settings.shadingPath == settings.DEFERRED;
+      createLitPipelines({{false, variant, depthPrePass, gBuffer}, {true, variant, depthPrePass, gBuffer}, {true, variantWithoutNormalMap, depthPrePass, gBuffer}});
+      
+      if (gBuffer) getDeferredLightingPipeline(variant);
     }
     
     VkExtent2D extent = gfx::getSurfaceExtent();
     matrices.proj = createProjectionMatrix(extent.width, extent.height, 0.5);
+    matrices.inverseProj = inverse(matrices.proj);
     
     cameraPos.x = 3.388;
     cameraPos.y = 2;
@@ -144,28 +356,37 @@ namespace presentation {
   
   void update(float deltaTime) {
     updateViewMatrix(deltaTime, false);
+    matrices.inverseView = inverse(matrices.view);
   }
   
-  static void setUniforms(VkCommandBuffer cmdBuffer, vector<ShadowMap> *shadowMaps) {
-    // Update matrices buffer
-    gfx::setBufferMemory(matricesBufferMemory, sizeof(matrices), &matrices);
+  static void setUniforms(VkCommandBuffer cmdBuffer, ShadowMap *shadowMap) {
+    // Upload the matrices and light view offsets into this frame's uniform ring segment
+    uint32_t lightMatricesOffset;
+    VkDescriptorSet lightMatricesDescSet = shadows::getMatricesDescSet(&lightMatricesOffset);
+    
+    matrices.lightPosInView = matrices.view * vec4(shadows::getLightPos(), 1);
+    uint32_t matricesOffset = gfx::pushUniformData(sizeof(matrices), &matrices);
     
-    // Update light view offset buffer
-    auto lightViewOffsets = shadows::getViewOffsets();
-    gfx::setBufferMemory(lightViewOffsetsBufferMemory, sizeof(lightViewOffsets[0]) * lightViewOffsets.size(), lightViewOffsets.data());
+    uint32_t shadowLayersOffset;
+    VkDescriptorSet shadowLayersDescSet = shadows::getLayersDescSet(&shadowLayersOffset);
     
     // Bind
-    VkDescriptorSet lightMatricesDescSet = shadows::getMatricesDescSet();
-    vector<VkDescriptorSet> sets = {lightMatricesDescSet, matricesDescSet, lightViewOffsetsDescSet};
-    for (int i = 0; i < MAX_LIGHT_SUBSOURCE_COUNT; i++) sets.push_back((*shadowMaps)[i].samplerDescriptorSet);
+    vector<VkDescriptorSet> sets = {lightMatricesDescSet, matricesDescSet, shadowLayersDescSet, shadowMap->arraySamplerDescSet, shadowMap->arrayDepthDescSet, shadowMap->momentsDescSet};
     
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, basicPipelineLayout, 1, (int)sets.size(), sets.data(), 0, nullptr);
+    // Dynamic offsets are consumed in set order
+    uint32_t dynamicOffsets[] = {lightMatricesOffset, matricesOffset, shadowLayersOffset};
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, basicPipelineLayout, 1, (int)sets.size(), sets.data(), 3, dynamicOffsets);
     
-    pushConstants.subsourceCount       = settings.subsourceCount;
+    pushConstants.subsourceCount       = shadows::getSubsourceCount();
     pushConstants.shadowAntiAliasSize  = settings.shadowAntiAliasSize;
     pushConstants.renderTexturesBool   = settings.renderTextures;
     pushConstants.renderNormalMapsBool = settings.renderNormalMaps;
     pushConstants.ambReflection        = settings.ambReflection;
+    pushConstants.shadowFilterMode     = settings.shadowFilterMode;
+    pushConstants.shadowFilterTapCount = settings.shadowFilterTapCount;
+    pushConstants.pcssBool             = settings.softShadowMode == settings.PCSS;
+    pushConstants.lightRadius          = settings.sourceRadius;
+    pushConstants.momentsDistanceRange = shadows::getFarDistance();
     vkCmdPushConstants(cmdBuffer, basicPipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
   }
   
@@ -178,24 +399,93 @@ namespace presentation {
     lightSource->addToCmdBuffer(cmdBuffer, basicPipelineLayout);
   }
   
-  void render(VkCommandBuffer cmdBuffer, vector<ShadowMap> *shadowMaps) {
-    setUniforms(cmdBuffer, shadowMaps);
+  // Fills pipelinesOut with the pipeline for each geometry::Shading. Without textures or normal maps, everything is drawn with lit.
+  static void getScenePipelines(bool gBuffer, VkPipeline pipelinesOut[3]) {
+    ShaderVariant variant = getCurrentShaderVariant();
+    ShaderVariant variantWithoutNormalMap = variant;
+    variantWithoutNormalMap.renderNormalMap = VK_FALSE;
+    
+    bool textured = settings.renderTextures || settings.renderNormalMaps;
+    bool depthPrePass = settings.depthPrePass;
+    pipelinesOut[geometry::BARE]          = getLitPipeline({false, variant, depthPrePass, gBuffer});
+    pipelinesOut[geometry::NORMAL_MAPPED] = getLitPipeline({textured, variant, depthPrePass, gBuffer});
+    pipelinesOut[geometry::TEXTURED]      = getLitPipeline({textured, variantWithoutNormalMap, depthPrePass, gBuffer});
+  }
+  
+  static void renderSceneDraws(VkCommandBuffer cmdBuffer, const vector<geometry::MainPassDraw> &draws, const VkPipeline pipelines[3]) {
     
-    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, litPipeline);
-    geometry::renderBareGeometry(cmdBuffer, basicPipelineLayout);
+    // Draws arrive grouped by pipeline and material, and front to back within each group, so early depth testing rejects most hidden fragments before the shadow filtering runs
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    int boundMaterialIndex = -1;
     
-    if (settings.renderTextures || settings.renderNormalMaps) {
-      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, litTexturedPipeline);
+    for (auto &draw : draws) {
+      if (pipelines[draw.shading] != boundPipeline) {
+        boundPipeline = pipelines[draw.shading];
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, boundPipeline);
+      }
+      
+      if ((int)draw.materialIndex != boundMaterialIndex && !draw.samplerDescSets->empty()) {
+        boundMaterialIndex = draw.materialIndex;
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, texturedPipelineLayout, 7, (int)draw.samplerDescSets->size(), draw.samplerDescSets->data(), 0, nullptr);
+      }
+      
+      draw.drawCall->addToCmdBuffer(cmdBuffer, draw.shading == geometry::BARE ? basicPipelineLayout : texturedPipelineLayout);
     }
+  }
+  
+  void performGBufferPass(VkCommandBuffer cmdBuffer, ShadowMap *shadowMap) {
+    if (settings.shadingPath != settings.DEFERRED) return;
     
-    geometry::renderTexturedNormalMappedGeometry(cmdBuffer, texturedPipelineLayout);
+    VkPipeline pipelines[3];
+    getScenePipelines(true, pipelines);
     
-    pushConstants.renderNormalMapsBool = 0;
-    vkCmdPushConstants(cmdBuffer, basicPipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
-    geometry::renderTexturedGeometry(cmdBuffer, texturedPipelineLayout);
+    deferred::cmdBeginGBufferPass(cmdBuffer);
+    setUniforms(cmdBuffer, shadowMap);
+    renderSceneDraws(cmdBuffer, geometry::getMainPassDraws(matrices.view, matrices.proj), pipelines);
+    vkCmdEndRenderPass(cmdBuffer);
+  }
+  
+  // A fullscreen triangle that shades the G-buffer. Each pixel runs the shadow filtering once, or twice where its samples straddle an edge, however many surfaces were drawn over it.
+  static void renderDeferredLighting(VkCommandBuffer cmdBuffer) {
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, getDeferredLightingPipeline(getCurrentShaderVariant()));
+    
+    auto descSets = deferred::getGBufferDescSets();
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferredPipelineLayout, 7, (int)descSets.size(), descSets.data(), 0, nullptr);
     
+    vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+  }
+  
+  void render(VkCommandBuffer cmdBuffer, ShadowMap *shadowMap) {
+    setUniforms(cmdBuffer, shadowMap);
+    
+    if (settings.shadingPath == settings.DEFERRED) {
+      renderDeferredLighting(cmdBuffer);
+      renderLightSource(cmdBuffer);
+      return;
+    }
+    
+    VkPipeline pipelines[3];
+    getScenePipelines(false, pipelines);
+    
+    auto draws = geometry::getMainPassDraws(matrices.view, matrices.proj);
+    
+    // Fill the depth buffer first, so the lit draws below only shade the surfaces that end up visible
+    if (settings.depthPrePass) {
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrePassPipeline);
+      for (auto &draw : draws) draw.drawCall->addToCmdBuffer(cmdBuffer, basicPipelineLayout);
+    }
+    
+    renderSceneDraws(cmdBuffer, draws, pipelines);
     renderLightSource(cmdBuffer);
   }
+  
+  mat4 getViewMatrix() {
+    return matrices.view;
+  }
+  
+  mat4 getProjectionMatrix() {
+    return matrices.proj;
+  }
 }
 
 
@@ -5,5 +5,8 @@
 namespace presentation {
   void init();
   void update(float deltaTime);
-  void render(VkCommandBuffer cmdBuffer, vector<ShadowMap> *shadowMaps);
+  void performGBufferPass(VkCommandBuffer cmdBuffer, ShadowMap *shadowMap); // Only when shading is deferred
+  void render(VkCommandBuffer cmdBuffer, ShadowMap *shadowMap);
+  mat4 getViewMatrix();
+  mat4 getProjectionMatrix();
 }
\ No newline at end of file
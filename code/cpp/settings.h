@@ -3,7 +3,14 @@
 #define SHADOWMAP_RESOLUTION 2048
 #define MAX_LIGHT_SUBSOURCE_COUNT 14
 #define MAX_SHADOW_ANTI_ALIAS_SIZE 10
+#define MAX_SHADOW_FILTER_TAP_COUNT 32
 #define MSAA_SETTING VK_SAMPLE_COUNT_8_BIT
+#define FRAMES_IN_FLIGHT 2
+#define UNIFORM_RING_FRAME_SIZE (1024 * 1024)
+#define STAGING_BUFFER_SIZE (16 * 1024 * 1024)
+#define CASCADE_COUNT 4
+#define CASCADE_SHADOW_DISTANCE 60
+#define QUANTIZE_VERTEX_POSITIONS false // 16-bit positions relative to each mesh's bounds, instead of 32-bit floats
 
 struct Settings {
   int subsourceCount = 8;
@@ -16,10 +23,45 @@ struct Settings {
   bool animateLightPos = true;
   bool renderTextures = true;
   bool renderNormalMaps = true;
+  
+  // Lays down the main pass's depth before shading it, so the lit shaders run about once per visible pixel instead of once per overlapping surface
+  bool depthPrePass = true;
+  
+  // FORWARD shades each surface as it's drawn. DEFERRED draws the scene into a G-buffer first (see deferred.h), then shades it in a single fullscreen pass.
+  enum {
+    FORWARD,
+    DEFERRED
+  } shadingPath = FORWARD;
+  
   float ambReflection = 0.2;
   
+  // POINT is the original light, which circles the scene and uses a perspective shadowmap per subsource. DIRECTIONAL is a distant light whose shadowmap layers are cascades fitted to the camera frustum.
+  enum {
+    POINT,
+    DIRECTIONAL
+  } lightType = POINT;
+  
+  // SUBSOURCES renders a shadowmap per subsource, PCSS renders one and estimates the penumbra from sourceRadius.
+  enum {
+    SUBSOURCES,
+    PCSS
+  } softShadowMode = SUBSOURCES;
+  
   float sourceRadius = 0.4;
   int shadowAntiAliasSize = 2;
+  
+  // The values must match the constants in lighting.glsl
+  enum {
+    SQUARE_PCF,
+    POISSON_PCF,
+    BLUE_NOISE_PCF,
+    GATHER_PCF,
+    VSM,
+    ESM
+  } shadowFilterMode = SQUARE_PCF;
+  
+  // Used by the Poisson and blue noise modes, which take this many fetches no matter the kernel size.
+  int shadowFilterTapCount = 16;
 };
 
 extern Settings settings;
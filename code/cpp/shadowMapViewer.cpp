@@ -2,42 +2,34 @@
 #include "main.h"
 #include "graphics.h"
 #include "settings.h"
+#include "shadows.h"
 
 namespace shadowMapViewer {
   VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
   VkPipeline       pipeline       = VK_NULL_HANDLE;
   
   VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
+  gfx::MemoryAllocation vertexBufferMemory;
   
-  vector<VkBuffer> matrixBuffers;
-  vector<VkDeviceMemory> matrixBufferMemories;
-  vector<VkDescriptorSet> matrixDescriptorSets;
+  VkDescriptorSet matrixDescriptorSet = VK_NULL_HANDLE;
   
-  vector<ShadowMap> *shadowMaps;
+  ShadowMap *shadowMap;
   
   vector<vec3> vertices = {
     vec3(0, 0, 0), vec3(1, 0, 0), vec3(0, 1, 0),
     vec3(0, 1, 0), vec3(1, 0, 0), vec3(1, 1, 0)
   };
   
-  void init(vector<ShadowMap> *shadowMaps_) {
-    shadowMaps = shadowMaps_;
+  void init(ShadowMap *shadowMap_) {
+    shadowMap = shadowMap_;
     
-    // Create matrix handles
-    matrixBuffers.resize(shadowMaps->size());
-    matrixBufferMemories.resize(shadowMaps->size());
-    matrixDescriptorSets.resize(shadowMaps->size());
-    
-    for (int i = 0; i < shadowMaps->size(); i++) {
-      gfx::createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(mat4), &matrixBuffers[i], &matrixBufferMemories[i]);
-      matrixDescriptorSets[i] = gfx::createDescSet(matrixBuffers[i]);
-    }
+    // Each quad's matrix is pushed into the uniform ring, so one descriptor set serves them all.
+    matrixDescriptorSet = gfx::getUniformRingDescSet(sizeof(mat4));
     
     // Create pipeline
-    VkDescriptorSetLayout descSetLayouts[] = {gfx::bufferDescLayout, gfx::samplerDescLayout};
+    VkDescriptorSetLayout descSetLayouts[] = {gfx::dynamicBufferDescLayout, gfx::samplerDescLayout};
     pipelineLayout = gfx::createPipelineLayout(descSetLayouts, 2, 0);
-    vector<VkFormat> vertAttribFormats = {VK_FORMAT_R32G32B32_SFLOAT};
+    vector<vector<VkFormat>> vertAttribFormats = {{VK_FORMAT_R32G32B32_SFLOAT}};
     pipeline = gfx::createPipeline(pipelineLayout, vertAttribFormats, gfx::getSurfaceExtent(), gfx::renderPass, VK_CULL_MODE_BACK_BIT, "shadowMapViewer.vert.spv", "shadowMapViewer.frag.spv", MSAA_SETTING);
     gfx::createVec3Buffer(vertices, &vertexBuffer, &vertexBufferMemory);
   }
@@ -51,10 +43,10 @@ namespace shadowMapViewer {
     matrix = translate(matrix, vec3(-aspectRatio, 1-size - size*shadowMapIndex, 0));
     matrix = scale(matrix, vec3(size, size, 1));
     
-    gfx::setBufferMemory(matrixBufferMemories[shadowMapIndex], sizeof(matrix), &matrix);
+    uint32_t matrixOffset = gfx::pushUniformData(sizeof(matrix), &matrix);
     
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &matrixDescriptorSets[shadowMapIndex], 0, nullptr);
-    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &(*shadowMaps)[shadowMapIndex].samplerDescriptorSet, 0, nullptr);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &matrixDescriptorSet, 1, &matrixOffset);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &shadowMap->layerSamplerDescSets[shadowMapIndex], 0, nullptr);
     
     VkDeviceSize vertexBufferOffset = 0;
     vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vertexBuffer, &vertexBufferOffset);
@@ -62,11 +54,11 @@ namespace shadowMapViewer {
     vkCmdDraw(cmdBuffer, (int)vertices.size(), 1, 0, 0);
   }
   
-  void render(const gfx::SwapchainFrame *frame) {
-    vkCmdBindPipeline(frame->cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  void render(VkCommandBuffer cmdBuffer) {
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
     
-    for (int i = 0; i < settings.subsourceCount; i++) {
-      renderQuad(frame->cmdBuffer, i);
+    for (int i = 0; i < shadows::getSubsourceCount(); i++) {
+      renderQuad(cmdBuffer, i);
     }
   }
 }
@@ -3,6 +3,6 @@
 #include "ShadowMap.h"
 
 namespace shadowMapViewer {
-  void init(vector<ShadowMap> *shadowMaps);
-  void render(const gfx::SwapchainFrame *frame);
+  void init(ShadowMap *shadowMap);
+  void render(VkCommandBuffer cmdBuffer);
 }
\ No newline at end of file
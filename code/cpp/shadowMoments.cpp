@@ -0,0 +1,148 @@
+#include "shadowMoments.h"
+#include "shadows.h"
+#include "settings.h"
+
+// Turns the shadowmap depth layers into blurred moments for the VSM and ESM filter modes. The blur is separable: the first pass converts depth to moments and blurs horizontally into a scratch image, the second blurs that vertically into the shadowmap's moments layer. Its cost depends on the shadowmap resolution, not on the screen size.
+namespace shadowMoments {
+  VkRenderPass     renderPass           = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout       = VK_NULL_HANDLE;
+  VkPipeline       horizontalPipeline   = VK_NULL_HANDLE;
+  VkPipeline       verticalPipeline     = VK_NULL_HANDLE;
+  
+  ShadowMap *shadowMap;
+  
+  VkImage               scratchImage;
+  gfx::MemoryAllocation scratchImageMemory;
+  VkImageView           scratchImageView;
+  VkFramebuffer         scratchFramebuffer;
+  VkDescriptorSet       scratchDescSet;
+  
+  vector<VkFramebuffer> layerFramebuffers;
+  
+  // Must match the push constant block in shadowMoments.frag and shadowMomentsBlur.frag
+  struct {
+    int32_t layer;
+    uint32_t esmBool;
+    int32_t blurRadius;
+    
+    // Entries [2][2] and [3][2] of the light projection, for converting depth back into distance
+    float projZScale;
+    float projZOffset;
+    
+    // Distances are divided by this before being stored
+    float distanceRange;
+  } pushConstants;
+  
+  void createRenderPass() {
+    // Every texel is overwritten, so the previous contents are never loaded.
+    VkAttachmentDescription colorAttachment = gfx::createAttachmentDescription(shadowMap->momentsFormat, false, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    
+    VkAttachmentReference colorAttachmentRef = {};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    
+    VkSubpassDescription subpassDesc = {};
+    subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpassDesc.colorAttachmentCount = 1;
+    subpassDesc.pColorAttachments = &colorAttachmentRef;
+    
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpassDesc;
+    
+    // The second dependency makes the next pass (the vertical blur or the main render pass) wait for the moments to be written before sampling them.
+    VkSubpassDependency subpassDeps[2];
+    subpassDeps[0] = gfx::createSubpassDependency();
+    
+    subpassDeps[1] = {};
+    subpassDeps[1].srcSubpass = 0;
+    subpassDeps[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDeps[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    subpassDeps[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    subpassDeps[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    subpassDeps[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = subpassDeps;
+    
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &colorAttachment;
+    
+    auto result = vkCreateRenderPass(gfx::device, &renderPassInfo, nullptr, &renderPass);
+    SDL_assert_release(result == VK_SUCCESS);
+  }
+  
+  void init(ShadowMap *shadowMap_) {
+    shadowMap = shadowMap_;
+    
+    createRenderPass();
+    
+    gfx::createImage(shadowMap->momentsFormat, shadowMap->width, shadowMap->height, &scratchImage, &scratchImageMemory);
+    scratchImageView = gfx::createImageView(scratchImage, shadowMap->momentsFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    scratchFramebuffer = gfx::createFramebuffer(renderPass, {scratchImageView}, shadowMap->width, shadowMap->height);
+    scratchDescSet = gfx::createDescSet(scratchImageView, shadowMap->sampler);
+    
+    for (uint32_t i = 0; i < shadowMap->layerCount; i++) {
+      layerFramebuffers.push_back(gfx::createFramebuffer(renderPass, {shadowMap->momentsLayerViews[i]}, shadowMap->width, shadowMap->height));
+    }
+    
+    VkDescriptorSetLayout descSetLayouts[] = {gfx::samplerDescLayout};
+    pipelineLayout = gfx::createPipelineLayout(descSetLayouts, 1, sizeof(pushConstants));
+    
+    // Both passes draw a single fullscreen triangle, so there are no vertex attributes.
+    VkExtent2D extent;
+    extent.width = shadowMap->width;
+    extent.height = shadowMap->height;
+    gfx::PipelineDesc horizontalDesc;
+    horizontalDesc.layout = pipelineLayout;
+    horizontalDesc.extent = extent;
+    horizontalDesc.renderPass = renderPass;
+    horizontalDesc.cullMode = VK_CULL_MODE_NONE;
+    horizontalDesc.vertexShaderPath = "fullscreen.vert.spv";
+    horizontalDesc.fragmentShaderPath = "shadowMoments.frag.spv";
+    
+    gfx::PipelineDesc verticalDesc = horizontalDesc;
+    verticalDesc.fragmentShaderPath = "shadowMomentsBlur.frag.spv";
+    
+    auto pipelines = gfx::createPipelines({horizontalDesc, verticalDesc});
+    horizontalPipeline = pipelines[0];
+    verticalPipeline = pipelines[1];
+  }
+  
+  void performRenderPasses(VkCommandBuffer cmdBuffer, int layerCount) {
+    if (settings.shadowFilterMode != settings.VSM && settings.shadowFilterMode != settings.ESM) return;
+    
+    // The moments are derived from a perspective depth, so they're only used for the point light.
+    if (settings.lightType != settings.POINT) return;
+    
+    mat4 proj = shadows::getProjectionMatrix();
+    pushConstants.esmBool       = settings.shadowFilterMode == settings.ESM;
+    pushConstants.blurRadius    = settings.shadowAntiAliasSize;
+    pushConstants.projZScale    = proj[2][2];
+    pushConstants.projZOffset   = proj[3][2];
+    pushConstants.distanceRange = shadows::getFarDistance();
+    
+    // Not used, as the attachments aren't loaded or cleared
+    vec3 clearColor = {0, 0, 0};
+    
+    for (int i = 0; i < layerCount; i++) {
+      pushConstants.layer = i;
+      
+      gfx::cmdBeginRenderPass(renderPass, shadowMap->width, shadowMap->height, clearColor, scratchFramebuffer, cmdBuffer);
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, horizontalPipeline);
+      vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &shadowMap->arrayDepthDescSet, 0, nullptr);
+      vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
+      vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+      vkCmdEndRenderPass(cmdBuffer);
+      
+      gfx::cmdBeginRenderPass(renderPass, shadowMap->width, shadowMap->height, clearColor, layerFramebuffers[i], cmdBuffer);
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, verticalPipeline);
+      vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &scratchDescSet, 0, nullptr);
+      vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
+      vkCmdDraw(cmdBuffer, 3, 1, 0, 0);
+      vkCmdEndRenderPass(cmdBuffer);
+    }
+  }
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "graphics.h"
+#include "ShadowMap.h"
+
+namespace shadowMoments {
+  void init(ShadowMap *shadowMap);
+  void performRenderPasses(VkCommandBuffer cmdBuffer, int layerCount);
+}
@@ -1,14 +1,22 @@
 #include "shadows.h"
 #include "geometry.h"
 #include "settings.h"
+#include "presentation.h"
 
 namespace shadows {
-  VkRenderPass renderPass;
-  VkPipeline       pipeline       = VK_NULL_HANDLE;
   VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
   
-  vector<ShadowMap> *shadowMaps;
-  vector<VkFramebuffer> framebuffers;
+  ShadowMap *shadowMap;
+  
+  // Multiview path: all used subsources are rendered in one pass. The view mask is baked into the render pass (and so into pipeline compatibility), so there is a render pass, framebuffer and lazily-created pipeline per subsource count.
+  VkRenderPass  multiviewRenderPasses[MAX_LIGHT_SUBSOURCE_COUNT] = {};
+  VkFramebuffer multiviewFramebuffers[MAX_LIGHT_SUBSOURCE_COUNT] = {};
+  VkPipeline    multiviewPipelines[MAX_LIGHT_SUBSOURCE_COUNT] = {};
+  
+  // Fallback path for devices without multiview: one pass per used subsource, each rendering into its own layer.
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkPipeline   pipeline   = VK_NULL_HANDLE;
+  vector<VkFramebuffer> layerFramebuffers;
   
   vec3 lightPos;
   vec2 lightAngle;
@@ -18,26 +26,44 @@ namespace shadows {
     mat4 proj;
   } matrices;
   
-  VkBuffer        matricesBuffer       = VK_NULL_HANDLE;
-  VkDeviceMemory  matricesBufferMemory = VK_NULL_HANDLE;
-  VkDescriptorSet matricesDescSet      = VK_NULL_HANDLE;
+  VkDescriptorSet matricesDescSet = VK_NULL_HANDLE;
+  
+  // Per-layer data for the shadow pass and the lit shaders. Point lights offset each subsource's view, while directional lights give each cascade its own projection from light view space.
+  struct {
+    vec4 offsets[MAX_LIGHT_SUBSOURCE_COUNT]; // std140 pads each array element to 16 bytes, hence vec4 rather than vec2.
+    mat4 cascadeProjections[CASCADE_COUNT];
+    vec4 cascadeSplits; // The camera view distance at which each cascade ends
+    uint32_t cascadesBool;
+    uint32_t padding[3];
+  } layersUniform;
+  
+  // The shaders declare ShadowLayers with literal array sizes, and cascadeSplits holds one split per cascade.
+  static_assert(CASCADE_COUNT == 4, "ShadowLayers in the shaders must be resized along with CASCADE_COUNT");
+  static_assert(MAX_LIGHT_SUBSOURCE_COUNT == 14, "ShadowLayers in the shaders must be resized along with MAX_LIGHT_SUBSOURCE_COUNT");
+  static_assert(sizeof(layersUniform) == 512, "layersUniform must match the std140 layout of ShadowLayers");
+  
+  VkDescriptorSet layersDescSet = VK_NULL_HANDLE;
   
-  void createRenderPass() {
-    VkAttachmentDescription colorAttachment = gfx::createAttachmentDescription((*shadowMaps)[0].format, true, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    VkAttachmentDescription depthAttachment = gfx::createAttachmentDescription(gfx::depthImageFormat, true, VK_ATTACHMENT_STORE_OP_DONT_CARE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+  // The directional light is placed this far from the origin, so that the lit shaders' lighting is effectively parallel.
+  const float directionalLightDistance = 1000;
+  
+  // Cascades are extended towards the light by this much, so that casters between the light and the camera frustum still land in the shadowmap.
+  const float cascadeCasterMargin = 30;
+  
+  VkRenderPass createRenderPass(uint32_t viewCount) {
+    // The shadowmap is depth-only, so there is no color attachment and the depth is stored for sampling.
+    VkAttachmentDescription depthAttachment = gfx::createAttachmentDescription(shadowMap->format, true, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     
-    VkAttachmentReference colorAttachmentRef = {};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    // The shadow map is transitioned to SHADER_READ_ONLY_OPTIMAL on creation and always left that way, so transitioning from UNDEFINED would discard layers that aren't rendered this frame.
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     
     VkAttachmentReference depthAttachmentRef = {};
-    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.attachment = 0;
     depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
     
     VkSubpassDescription subpassDesc = {};
     subpassDesc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpassDesc.colorAttachmentCount = 1;
-    subpassDesc.pColorAttachments = &colorAttachmentRef;
+    subpassDesc.colorAttachmentCount = 0;
     subpassDesc.pDepthStencilAttachment = &depthAttachmentRef;
     
     VkRenderPassCreateInfo renderPassInfo = {};
@@ -46,41 +72,162 @@ namespace shadows {
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpassDesc;
     
-    VkSubpassDependency subpassDep = gfx::createSubpassDependency();
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &subpassDep;
+    // The second dependency makes the main render pass wait for the shadowmap to be written before sampling it.
+    VkSubpassDependency subpassDeps[2];
+    subpassDeps[0] = gfx::createSubpassDependency();
+    
+    subpassDeps[1] = {};
+    subpassDeps[1].srcSubpass = 0;
+    subpassDeps[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    subpassDeps[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    subpassDeps[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    subpassDeps[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    subpassDeps[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    
+    renderPassInfo.dependencyCount = 2;
+    renderPassInfo.pDependencies = subpassDeps;
+    
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &depthAttachment;
     
-    vector<VkAttachmentDescription> attachments = { colorAttachment, depthAttachment };
-    renderPassInfo.attachmentCount = (uint32_t)attachments.size();
-    renderPassInfo.pAttachments = attachments.data();
+    // A view count of 0 means a plain (non-multiview) render pass
+    uint32_t viewMask = (1u << viewCount) - 1;
     
-    auto result = vkCreateRenderPass(gfx::device, &renderPassInfo, nullptr, &renderPass);
+    VkRenderPassMultiviewCreateInfo multiviewInfo = {};
+    multiviewInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+    multiviewInfo.subpassCount = 1;
+    multiviewInfo.pViewMasks = &viewMask;
+    
+    // All views share the same geometry, so hint that they can be processed together
+    multiviewInfo.correlationMaskCount = 1;
+    multiviewInfo.pCorrelationMasks = &viewMask;
+    
+    if (viewCount > 0) renderPassInfo.pNext = &multiviewInfo;
+    
+    VkRenderPass newRenderPass;
+    auto result = vkCreateRenderPass(gfx::device, &renderPassInfo, nullptr, &newRenderPass);
     SDL_assert_release(result == VK_SUCCESS);
+    return newRenderPass;
+  }
+  
+  VkExtent2D getExtent() {
+    VkExtent2D extent;
+    extent.width = shadowMap->width;
+    extent.height = shadowMap->height;
+    return extent;
   }
   
-  void init(vector<ShadowMap> *shadowMaps_) {
-    shadowMaps = shadowMaps_;
+  VkPipeline getMultiviewPipeline(int subsourceCount) {
+    VkPipeline &multiviewPipeline = multiviewPipelines[subsourceCount-1];
+    
+    if (multiviewPipeline == VK_NULL_HANDLE) {
+      auto vertAttribFormats = DrawCall::getVertexStreamFormats(true);
+      multiviewPipeline = gfx::createPipeline(pipelineLayout, vertAttribFormats, getExtent(), multiviewRenderPasses[subsourceCount-1], VK_CULL_MODE_FRONT_BIT, "shadowMapMultiview.vert.spv", nullptr);
+    }
     
-    gfx::createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sizeof(matrices), &matricesBuffer, &matricesBufferMemory);
-    matricesDescSet = gfx::createDescSet(matricesBuffer);
+    return multiviewPipeline;
+  }
+  
+  void init(ShadowMap *shadowMap_) {
+    shadowMap = shadowMap_;
+    SDL_assert_release(shadowMap->layerCount == MAX_LIGHT_SUBSOURCE_COUNT);
     
-    createRenderPass();
+    matricesDescSet = gfx::getUniformRingDescSet(sizeof(matrices));
+    layersDescSet = gfx::getUniformRingDescSet(sizeof(layersUniform));
     
-    framebuffers.resize(shadowMaps->size());
+    vector<VkDescriptorSetLayout> descSetLayouts = {gfx::dynamicBufferDescLayout, gfx::dynamicBufferDescLayout, gfx::dynamicBufferDescLayout};
+    pipelineLayout = gfx::createPipelineLayout(descSetLayouts.data(), (int)descSetLayouts.size(), sizeof(int32_t));
     
-    for (int i = 0; i < shadowMaps->size(); i++) {
-      ShadowMap &shadowMap = (*shadowMaps)[i];
-      framebuffers[i] = gfx::createFramebuffer(renderPass, {shadowMap.imageView, shadowMap.depthImageView}, shadowMap.width, shadowMap.height);
+    if (gfx::multiviewEnabled) {
+      for (int i = 0; i < MAX_LIGHT_SUBSOURCE_COUNT; i++) {
+        multiviewRenderPasses[i] = createRenderPass(i+1);
+        
+        // Multiview framebuffers have a single layer; the view mask selects the layers of the array views.
+        multiviewFramebuffers[i] = gfx::createFramebuffer(multiviewRenderPasses[i], {shadowMap->arrayView}, shadowMap->width, shadowMap->height);
+      }
+    } else {
+      renderPass = createRenderPass(0);
+      
+      for (uint32_t i = 0; i < shadowMap->layerCount; i++) {
+        layerFramebuffers.push_back(gfx::createFramebuffer(renderPass, {shadowMap->layerViews[i]}, shadowMap->width, shadowMap->height));
+      }
+      
+      auto vertAttribFormats = DrawCall::getVertexStreamFormats(true);
+      pipeline = gfx::createPipeline(pipelineLayout, vertAttribFormats, getExtent(), renderPass, VK_CULL_MODE_FRONT_BIT, "shadowMap.vert.spv", nullptr);
     }
+  }
+  
+  // Returns the world space corners of the slice of the camera frustum between two view distances.
+  static vector<vec3> getCameraFrustumSlice(float nearDistance, float farDistance) {
+    mat4 proj = presentation::getProjectionMatrix();
+    mat4 inverseViewProj = inverse(proj * presentation::getViewMatrix());
     
-    vector<VkDescriptorSetLayout> descSetLayouts = {gfx::bufferDescLayout, gfx::bufferDescLayout};
-    pipelineLayout = gfx::createPipelineLayout(descSetLayouts.data(), (int)descSetLayouts.size(), sizeof(vec2));
+    // The camera's own near and far distances, recovered from its projection (right-handed, zero-to-one depth)
+    float cameraNear = proj[3][2] / proj[2][2];
+    float cameraFar = proj[3][2] / (1 + proj[2][2]);
     
-    vector<VkFormat> vertAttribFormats = {VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT};
-    VkExtent2D extent;
-    extent.width = (*shadowMaps)[0].width;
-    extent.height = (*shadowMaps)[0].height;
-    pipeline = gfx::createPipeline(pipelineLayout, vertAttribFormats, extent, renderPass, VK_CULL_MODE_FRONT_BIT, "shadowMap.vert.spv", "shadowMap.frag.spv");
+    vector<vec3> corners;
+    
+    for (float x : {-1.0f, 1.0f}) {
+      for (float y : {-1.0f, 1.0f}) {
+        vec4 nearCorner = inverseViewProj * vec4(x, y, 0, 1);
+        vec4 farCorner = inverseViewProj * vec4(x, y, 1, 1);
+        vec3 nearPos = vec3(nearCorner) / nearCorner.w;
+        vec3 farPos = vec3(farCorner) / farCorner.w;
+        
+        // Distance along the view direction is linear along each frustum edge
+        vec3 edge = farPos - nearPos;
+        corners.push_back(nearPos + edge * ((nearDistance - cameraNear) / (cameraFar - cameraNear)));
+        corners.push_back(nearPos + edge * ((farDistance - cameraNear) / (cameraFar - cameraNear)));
+      }
+    }
+    
+    return corners;
+  }
+  
+  static void updateCascades() {
+    mat4 proj = presentation::getProjectionMatrix();
+    float cameraNear = proj[3][2] / proj[2][2];
+    
+    // Practical split scheme: a blend of logarithmic splits (even texel density) and uniform splits (so the far cascades aren't too large).
+    const float lambda = 0.75;
+    float splitStart = cameraNear;
+    
+    for (int i = 0; i < CASCADE_COUNT; i++) {
+      float fraction = (i+1) / float(CASCADE_COUNT);
+      float logSplit = cameraNear * powf(CASCADE_SHADOW_DISTANCE / cameraNear, fraction);
+      float uniformSplit = cameraNear + (CASCADE_SHADOW_DISTANCE - cameraNear) * fraction;
+      float splitEnd = lambda * logSplit + (1 - lambda) * uniformSplit;
+      
+      auto corners = getCameraFrustumSlice(splitStart, splitEnd);
+      
+      // Fit a sphere rather than a box, so that the cascade's size doesn't change as the camera rotates.
+      vec3 centre(0, 0, 0);
+      for (auto &corner : corners) centre += corner;
+      centre /= (float)corners.size();
+      
+      float radius = 0;
+      for (auto &corner : corners) radius = std::max(radius, length(corner - centre));
+      radius = ceilf(radius * 16) / 16;
+      
+      // Snap the centre to whole texels in light view space, so that shadow edges don't shimmer as the camera moves.
+      float texelSize = radius * 2 / shadowMap->width;
+      vec3 centreInLightView = vec3(matrices.view * vec4(centre, 1));
+      centreInLightView.x = floorf(centreInLightView.x / texelSize) * texelSize;
+      centreInLightView.y = floorf(centreInLightView.y / texelSize) * texelSize;
+      
+      // The light looks down its view space's -Z axis
+      float nearDistance = -centreInLightView.z - radius - cascadeCasterMargin;
+      float farDistance = -centreInLightView.z + radius;
+      
+      mat4 cascadeProj = ortho(centreInLightView.x - radius, centreInLightView.x + radius, centreInLightView.y - radius, centreInLightView.y + radius, nearDistance, farDistance);
+      
+      // Flip the Y axis because Vulkan shaders expect positive Y to point downwards
+      layersUniform.cascadeProjections[i] = scale(cascadeProj, vec3(1, -1, 1));
+      layersUniform.cascadeSplits[i] = splitEnd;
+      
+      splitStart = splitEnd;
+    }
   }
   
   void update() {
@@ -95,28 +242,55 @@ namespace shadows {
       lightPos.z = 0.0001; // Non-zero in order to work around a bug in glm::lookAt()
     }
     
+    if (settings.lightType == settings.DIRECTIONAL) {
+      lightPos = normalize(lightPos) * directionalLightDistance;
+    }
+    
     matrices.view = lookAt(lightPos, vec3(0, 0, 0), vec3(0, 1, 0));
     
     float fieldOfView = 2.5;
-    float aspectRatio = (*shadowMaps)[0].width / (float)(*shadowMaps)[0].height;
+    float aspectRatio = shadowMap->width / (float)shadowMap->height;
     matrices.proj = perspective(fieldOfView, aspectRatio, 0.1f, 100.0f);
     
     // Flip the Y axis because Vulkan shaders expect positive Y to point downwards
     matrices.proj = scale(matrices.proj, vec3(1, -1, 1));
+    
+    layersUniform.cascadesBool = settings.lightType == settings.DIRECTIONAL;
+    if (layersUniform.cascadesBool) updateCascades();
   }
   
-  VkDescriptorSet getMatricesDescSet() {
-    gfx::setBufferMemory(matricesBufferMemory, sizeof(matrices), &matrices);
+  VkDescriptorSet getMatricesDescSet(uint32_t *dynamicOffsetOut) {
+    *dynamicOffsetOut = gfx::pushUniformData(sizeof(matrices), &matrices);
     SDL_assert_release(matricesDescSet != VK_NULL_HANDLE);
     return matricesDescSet;
   }
   
+  VkDescriptorSet getLayersDescSet(uint32_t *dynamicOffsetOut) {
+    auto viewOffsets = getViewOffsets();
+    
+    // Unused entries are left as they are; shaders only read the first getSubsourceCount().
+    for (int i = 0; i < viewOffsets.size(); i++) layersUniform.offsets[i] = vec4(viewOffsets[i], 0, 0);
+    
+    *dynamicOffsetOut = gfx::pushUniformData(sizeof(layersUniform), &layersUniform);
+    SDL_assert_release(layersDescSet != VK_NULL_HANDLE);
+    return layersDescSet;
+  }
+  
+  int getSubsourceCount() {
+    // Directional lights have one layer per cascade instead of subsources.
+    if (settings.lightType == settings.DIRECTIONAL) return CASCADE_COUNT;
+    
+    // PCSS takes the light's size into account in the lit shaders, so it only needs the central shadowmap.
+    return settings.softShadowMode == settings.PCSS ? 1 : settings.subsourceCount;
+  }
+  
   vector<vec2> getViewOffsets() {
     vector<vec2> offsets;
     
-    int offsetCount = settings.subsourceCount;
+    int offsetCount = getSubsourceCount();
     
     if (offsetCount == 1) return {vec2(0, 0)};
+    if (settings.lightType == settings.DIRECTIONAL) return vector<vec2>(offsetCount, vec2(0, 0));
     
     bool ringMode = settings.subsourceArrangement == settings.RING;
     
@@ -138,32 +312,75 @@ namespace shadows {
     return offsets;
   }
   
-  void performRenderPasses(VkCommandBuffer cmdBuffer) {
-    // This clear color must be higher than all rendered distances. The INFINITY macro cannot be used as it causes buggy rasterisation behaviour; GLSL doesn't officially support the IEEE infinity constant.
-    vec3 clearColor = {1000, 1000, 1000};
+  // Each layer's frustum in world space, matching getPositionInLayer() in shadowMap.vert
+  static vector<Frustum> getLayerFrusta() {
     auto viewOffsets = getViewOffsets();
+    vector<Frustum> frusta;
     
-    // Execute a renderpass for all possible shadowmaps even if they're not used, in order to convert their layouts.
-    for (int i = 0; i < MAX_LIGHT_SUBSOURCE_COUNT; i++) {
-      ShadowMap &shadowMap = (*shadowMaps)[i];
-      gfx::cmdBeginRenderPass(renderPass, shadowMap.width, shadowMap.height, clearColor, framebuffers[i], cmdBuffer);
+    for (int i = 0; i < getSubsourceCount(); i++) {
+      if (layersUniform.cascadesBool) {
+        frusta.push_back(Frustum(layersUniform.cascadeProjections[i] * matrices.view));
+      } else {
+        mat4 offsetView = translate(glm::identity<mat4>(), vec3(viewOffsets[i], 0)) * matrices.view;
+        frusta.push_back(Frustum(matrices.proj * offsetView));
+      }
+    }
+    
+    return frusta;
+  }
+  
+  void performRenderPasses(VkCommandBuffer cmdBuffer) {
+    int subsourceCount = getSubsourceCount();
+    auto frusta = getLayerFrusta();
+    
+    // The light matrices and layer data are the same for every subsource, so they're only uploaded once.
+    uint32_t matricesOffset;
+    auto updatedMatricesDescSet = getMatricesDescSet(&matricesOffset);
+    
+    uint32_t layersOffset;
+    auto updatedLayersDescSet = getLayersDescSet(&layersOffset);
+    
+    if (gfx::multiviewEnabled) {
+      gfx::cmdBeginDepthOnlyRenderPass(multiviewRenderPasses[subsourceCount-1], shadowMap->width, shadowMap->height, multiviewFramebuffers[subsourceCount-1], cmdBuffer);
+      
+      vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, getMultiviewPipeline(subsourceCount));
+      
+      vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &updatedMatricesDescSet, 1, &matricesOffset);
+      vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &updatedLayersDescSet, 1, &layersOffset);
+      
+      // Each draw is broadcast to every view, and gl_ViewIndex picks the layer. So a draw can only be skipped if it's outside all of the layers.
+      geometry::renderAllGeometryWithoutSamplers(cmdBuffer, pipelineLayout, frusta);
       
-      // Only render the shadowmaps that are being used this frame
-      if (i < settings.subsourceCount) {
+      vkCmdEndRenderPass(cmdBuffer);
+    } else {
+      // Unused layers are left alone; they're already in SHADER_READ_ONLY_OPTIMAL and the lit shaders don't read them.
+      for (int i = 0; i < subsourceCount; i++) {
+        gfx::cmdBeginDepthOnlyRenderPass(renderPass, shadowMap->width, shadowMap->height, layerFramebuffers[i], cmdBuffer);
+        
         vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
         
-        auto updatedMatricesDescSet = getMatricesDescSet();
-        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &updatedMatricesDescSet, 0, nullptr);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &updatedMatricesDescSet, 1, &matricesOffset);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &updatedLayersDescSet, 1, &layersOffset);
         
-        vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(vec2), &viewOffsets[i]);
+        int32_t layer = i;
+        vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(layer), &layer);
         
-        geometry::renderAllGeometryWithoutSamplers(cmdBuffer, pipelineLayout);
+        geometry::renderAllGeometryWithoutSamplers(cmdBuffer, pipelineLayout, {frusta[i]});
+        
+        vkCmdEndRenderPass(cmdBuffer);
       }
-      
-      vkCmdEndRenderPass(cmdBuffer);
     }
   }
   
+  mat4 getProjectionMatrix() {
+    return matrices.proj;
+  }
+  
+  // Recovered from the light's projection (right-handed, zero-to-one depth), so it follows any change to the far plane
+  float getFarDistance() {
+    return matrices.proj[3][2] / (1 + matrices.proj[2][2]);
+  }
+  
   vec3 getLightPos() {
     return lightPos;
   }
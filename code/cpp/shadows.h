@@ -3,10 +3,14 @@
 #include "ShadowMap.h"
 
 namespace shadows {
-  void init(vector<ShadowMap> *shadowMaps);
+  void init(ShadowMap *shadowMap);
   void update();
-  VkDescriptorSet getMatricesDescSet();
+  VkDescriptorSet getMatricesDescSet(uint32_t *dynamicOffsetOut);
+  VkDescriptorSet getLayersDescSet(uint32_t *dynamicOffsetOut);
   vector<vec2> getViewOffsets();
+  int getSubsourceCount();
   void performRenderPasses(VkCommandBuffer cmdBuffer);
+  mat4 getProjectionMatrix();
+  float getFarDistance();
   vec3 getLightPos();
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+// Shades the G-buffer in a single fullscreen pass. The lighting and shadow code is shared with lit.frag, but its inputs are reconstructed for each sample from the G-buffer instead of interpolated.
+
+layout(location = 0) out vec4 outColor;
+
+layout(set = 2, binding = 0) uniform Matrices {
+  mat4 view;
+  mat4 proj;
+  mat4 inverseView;
+  mat4 inverseProj;
+  vec4 lightPosInView;
+} matrices;
+
+// The G-buffer (see deferred.h), with MSAA_SETTING samples per pixel
+layout(set = 7, binding = 0) uniform sampler2DMS gBufferAlbedo;
+layout(set = 8, binding = 0) uniform sampler2DMS gBufferNormal;
+layout(set = 9, binding = 0) uniform sampler2DMS gBufferDepth;
+
+// Set by shadeSample() for lighting.glsl, which reads them like lit.frag reads its inputs
+vec3 surfacePos;
+vec3 surfacePosInLightView;
+vec3 lightPos;
+
+#include "lighting.glsl"
+
+// Samples this far apart in view space depth (relative to their distance), or with normals further apart than this dot product, belong to different surfaces
+const float EDGE_DEPTH_TOLERANCE = 0.01;
+const float EDGE_NORMAL_TOLERANCE = 0.9;
+
+// Inverse of encodeOctahedralNormal() in gBuffer.frag
+vec3 decodeOctahedralNormal(vec2 encoded) {
+  vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  
+  if (normal.z < 0) {
+    vec2 signs = vec2(normal.x >= 0 ? 1 : -1, normal.y >= 0 ? 1 : -1);
+    normal.xy = (1.0 - abs(normal.yx)) * signs;
+  }
+  
+  return normalize(normal);
+}
+
+// Every sample is treated as if it were at the pixel's centre
+vec3 getSurfacePosInView(ivec2 pixel, float depth) {
+  const vec2 normalisedDevicePos = (vec2(pixel) + 0.5) / vec2(textureSize(gBufferDepth)) * 2 - 1;
+  const vec4 posInView = matrices.inverseProj * vec4(normalisedDevicePos, depth, 1);
+  return posInView.xyz / posInView.w;
+}
+
+// The same lighting as lit.frag, for one sample of the G-buffer. Alpha is 0 where nothing was drawn, so that the clear color shows through.
+vec4 shadeSample(ivec2 pixel, int sampleIndex) {
+  const float depth = texelFetch(gBufferDepth, pixel, sampleIndex).r;
+  if (depth == 1) return vec4(0);
+  
+  const vec4 albedo = texelFetch(gBufferAlbedo, pixel, sampleIndex);
+  const vec4 normalAndSpec = texelFetch(gBufferNormal, pixel, sampleIndex);
+  
+  surfacePos = getSurfacePosInView(pixel, depth);
+  surfacePosInLightView = (lightMatrices.view * matrices.inverseView * vec4(surfacePos, 1)).xyz;
+  
+  const vec3 surfaceNormal = decodeOctahedralNormal(normalAndSpec.xy);
+  
+  // The albedo's alpha holds the diffuse constant, and the normal's blue and alpha hold the specular constant and power
+  return vec4(getLitColor(albedo.rgb, surfaceNormal, albedo.a, normalAndSpec.z, normalAndSpec.w), 1);
+}
+
+// Forward shading runs lit.frag once per pixel for every triangle that covers any of its samples. Here, sample 0's surface is shaded once, and where the samples straddle an edge, the first sample from another surface is shaded too. The two are blended by how many samples each covers, which resolves the edge much like MSAA would (a third surface in the same pixel takes the second one's color).
+void main() {
+  const ivec2 pixel = ivec2(gl_FragCoord.xy);
+  const int sampleCount = textureSamples(gBufferDepth);
+  
+  lightPos = matrices.lightPosInView.xyz;
+  
+  const float firstDepth = texelFetch(gBufferDepth, pixel, 0).r;
+  const float firstDistance = -getSurfacePosInView(pixel, firstDepth).z;
+  const vec3 firstNormal = decodeOctahedralNormal(texelFetch(gBufferNormal, pixel, 0).xy);
+  
+  int otherSample = -1;
+  int otherSampleCount = 0;
+  
+  for (int i = 1; i < sampleCount; i++) {
+    const float depth = texelFetch(gBufferDepth, pixel, i).r;
+    
+    bool sameSurface;
+    if (depth == 1 || firstDepth == 1) {
+      sameSurface = depth == firstDepth;
+    } else {
+      const float distance = -getSurfacePosInView(pixel, depth).z;
+      const vec3 normal = decodeOctahedralNormal(texelFetch(gBufferNormal, pixel, i).xy);
+      sameSurface = abs(distance - firstDistance) <= EDGE_DEPTH_TOLERANCE * firstDistance && dot(normal, firstNormal) >= EDGE_NORMAL_TOLERANCE;
+    }
+    
+    if (sameSurface) continue;
+    
+    if (otherSample == -1) otherSample = i;
+    otherSampleCount++;
+  }
+  
+  // Premultiplied by coverage, so that sky samples only contribute to the alpha
+  vec4 color = shadeSample(pixel, 0);
+  
+  if (otherSample != -1) {
+    color = mix(color, shadeSample(pixel, otherSample), float(otherSampleCount) / sampleCount);
+  }
+  
+  // Leave the clear color where there's only sky. Elsewhere, the pipeline's alpha blending puts the clear color behind the uncovered part of the pixel.
+  if (color.a == 0) discard;
+  outColor = vec4(color.rgb / color.a, color.a);
+}
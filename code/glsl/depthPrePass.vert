@@ -0,0 +1,30 @@
+#version 450
+
+// Depth-only pass ahead of lit.vert and litTextured.vert. gl_Position is computed exactly as they compute it, as they test against these depths with EQUAL.
+
+layout(location = 0) in vec3 vertPosInMesh;
+
+layout(set = 0, binding = 0) uniform DrawCall {
+  mat4 worldMatrix;
+  vec4 positionScale;
+  vec4 positionOffset;
+} drawCall;
+
+layout(set = 2, binding = 0) uniform Matrices {
+  mat4 view;
+  mat4 proj;
+} matrices;
+
+invariant gl_Position;
+
+// Positions may be quantized to the mesh's bounds (see QUANTIZE_VERTEX_POSITIONS)
+vec3 getPositionInMesh() {
+  return vertPosInMesh * drawCall.positionScale.xyz + drawCall.positionOffset.xyz;
+}
+
+void main() {
+  vec4 vertPosInWorld4 = drawCall.worldMatrix * vec4(getPositionInMesh(), 1.0);
+  vec4 vertPosInView4 = matrices.view * vertPosInWorld4;
+  
+  gl_Position = matrices.proj * vertPosInView4;
+}
@@ -0,0 +1,7 @@
+#version 450
+
+void main() {
+  // A single triangle that covers the whole viewport: (-1,-1), (3,-1), (-1,3)
+  vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+  gl_Position = vec4(position * 2 - 1, 0, 1);
+}
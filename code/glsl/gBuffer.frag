@@ -0,0 +1,39 @@
+#version 450
+
+// Writes the surface attributes that deferredLighting.frag shades, instead of shading like lit.frag. Takes its inputs from lit.vert.
+
+layout(location = 1) in vec3 interpSurfaceNormal;
+
+// Must match deferred::albedoFormat and deferred::normalFormat
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec4 outNormal;
+
+layout(set = 0, binding = 0) uniform DrawCall {
+  mat4 worldMatrix;
+  vec4 positionScale;
+  vec4 positionOffset;
+  float diffuseReflectionConst;
+  float specReflectionConst;
+  int specPowerConst;
+} drawCall;
+
+// Same as encodeOctahedralNormal() in DrawCall.cpp
+vec2 encodeOctahedralNormal(vec3 normal) {
+  normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+  vec2 encoded = normal.xy;
+  
+  if (normal.z < 0) {
+    vec2 signs = vec2(encoded.x >= 0 ? 1 : -1, encoded.y >= 0 ? 1 : -1);
+    encoded = (1.0 - abs(encoded.yx)) * signs;
+  }
+  
+  return encoded;
+}
+
+void main() {
+  // Interpolation can cause normals to be non-unit length, so we re-normalise them here
+  vec3 surfaceNormal = normalize(interpSurfaceNormal);
+  
+  outAlbedo = vec4(1, 1, 1, drawCall.diffuseReflectionConst);
+  outNormal = vec4(encodeOctahedralNormal(surfaceNormal), drawCall.specReflectionConst, drawCall.specPowerConst);
+}
@@ -0,0 +1,58 @@
+#version 450
+
+// Writes the surface attributes that deferredLighting.frag shades, instead of shading like litTextured.frag. Takes its inputs from litTextured.vert.
+
+layout(location = 1) in vec3 interpSurfaceNormal;
+layout(location = 4) in vec2 texCoord;
+layout(location = 5) in mat3 normalMatrix;
+
+// Must match deferred::albedoFormat and deferred::normalFormat
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec4 outNormal;
+
+layout(set = 0, binding = 0) uniform DrawCall {
+  mat4 worldMatrix;
+  vec4 positionScale;
+  vec4 positionOffset;
+  float diffuseReflectionConst;
+  float specReflectionConst;
+  int specPowerConst;
+} drawCall;
+
+// The IDs must match presentation::ShaderVariant
+layout(constant_id = 2) const bool RENDER_TEXTURE = true;
+layout(constant_id = 3) const bool RENDER_NORMAL_MAP = true;
+
+layout(set = 7, binding = 0) uniform sampler2D colorTexture;
+layout(set = 8, binding = 0) uniform sampler2D normalMap;
+
+// Same as encodeOctahedralNormal() in DrawCall.cpp
+vec2 encodeOctahedralNormal(vec3 normal) {
+  normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+  vec2 encoded = normal.xy;
+  
+  if (normal.z < 0) {
+    vec2 signs = vec2(encoded.x >= 0 ? 1 : -1, encoded.y >= 0 ? 1 : -1);
+    encoded = (1.0 - abs(encoded.yx)) * signs;
+  }
+  
+  return encoded;
+}
+
+void main() {
+  const vec3 color = RENDER_TEXTURE ? texture(colorTexture, texCoord).rgb : vec3(1);
+  
+  vec3 surfaceNormal;
+  
+  if (RENDER_NORMAL_MAP) {
+    // The normal map stores x and z; the up component is reconstructed (see cookedTexture::convertNormalMapTexel())
+    vec2 normalXZ = texture(normalMap, texCoord).rg;
+    vec3 normalInMesh = vec3(normalXZ.x, sqrt(max(0, 1 - dot(normalXZ, normalXZ))), normalXZ.y);
+    surfaceNormal = normalMatrix * normalInMesh;
+  } else {
+    surfaceNormal = normalize(interpSurfaceNormal);
+  }
+  
+  outAlbedo = vec4(color, drawCall.diffuseReflectionConst);
+  outNormal = vec4(encodeOctahedralNormal(surfaceNormal), drawCall.specReflectionConst, drawCall.specPowerConst);
+}
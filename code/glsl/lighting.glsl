@@ -0,0 +1,341 @@
+// Shadow filtering and lighting shared by lit.frag, litTextured.frag and deferredLighting.frag, which #include it. It isn't a shader stage of its own, so compile_shaders.py skips it.
+// The including shader declares surfacePos, lightPos (both in view space) and surfacePosInLightView before the #include.
+
+layout(set = 1, binding = 0) uniform LightMatrices {
+  mat4 view;
+  mat4 proj;
+} lightMatrices;
+
+// Point lights offset each subsource's view, while each cascade of a directional light has its own projection from light view space.
+layout(set = 3, binding = 0) uniform ShadowLayers {
+  vec2 offsets[14]; // MAX_LIGHT_SUBSOURCE_COUNT
+  mat4 cascadeProjections[4]; // CASCADE_COUNT
+  vec4 cascadeSplits;
+  bool cascades;
+} shadowLayers;
+
+layout(push_constant) uniform Config {
+  int shadowMapCount; // Specialized as SHADOW_MAP_COUNT
+  int shadowAntiAliasSize; // Specialized as SHADOW_ANTI_ALIAS_SIZE
+  bool renderTexture; // Specialized as RENDER_TEXTURE in litTextured.frag
+  bool renderNormalMap; // Specialized as RENDER_NORMAL_MAP in litTextured.frag
+  float ambReflection;
+  int shadowFilterMode;
+  int shadowFilterTapCount;
+  bool pcss;
+  float lightRadius;
+  float momentsDistanceRange; // The light's far plane distance
+} config;
+
+// Each pipeline variant bakes these in, so the shadowmap and PCF kernel loops have constant trip counts and can be unrolled. The IDs must match presentation::ShaderVariant.
+layout(constant_id = 0) const int SHADOW_MAP_COUNT = 1;
+layout(constant_id = 1) const int SHADOW_ANTI_ALIAS_SIZE = 0;
+
+layout(set = 4, binding = 0) uniform sampler2DArrayShadow shadowMaps;
+layout(set = 5, binding = 0) uniform sampler2DArray shadowDepths;
+layout(set = 6, binding = 0) uniform sampler2DArray shadowMoments;
+
+// Must match the filter mode enum in settings.h
+const int SQUARE_PCF     = 0;
+const int POISSON_PCF    = 1;
+const int BLUE_NOISE_PCF = 2;
+const int GATHER_PCF     = 3;
+const int VSM            = 4;
+const int ESM            = 5;
+
+const float TAU = 6.28318530718;
+
+// Best-candidate Poisson disc in the unit circle. Every prefix of it is also well distributed, so any tap count up to 32 can be used.
+const vec2 poissonDisc[32] = vec2[](
+  vec2(0.1598, -0.0876), vec2(-0.7077, 0.6530), vec2(-0.8787, -0.4625), vec2(0.3306, 0.8975),
+  vec2(-0.0138, -0.8831), vec2(0.8240, -0.5635), vec2(0.9388, 0.2750), vec2(-0.1045, 0.5021),
+  vec2(-0.5318, -0.0020), vec2(-0.3301, -0.4676), vec2(0.3945, 0.3464), vec2(-0.3064, 0.9510),
+  vec2(0.3448, -0.5371), vec2(-0.9627, 0.2239), vec2(0.7106, -0.1268), vec2(0.6989, 0.6908),
+  vec2(-0.4678, -0.8551), vec2(-0.4627, 0.3724), vec2(0.3615, -0.9236), vec2(-0.1626, 0.1160),
+  vec2(-0.9060, -0.1226), vec2(0.0106, -0.4251), vec2(0.0198, 0.8302), vec2(-0.5959, -0.3184),
+  vec2(0.2189, 0.5897), vec2(0.9969, -0.0257), vec2(-0.2271, -0.1801), vec2(0.4354, -0.2439),
+  vec2(0.1069, 0.2828), vec2(0.6159, -0.7810), vec2(-0.3902, 0.6599), vec2(0.4720, 0.0584)
+);
+
+// White noise in [0,1), used to rotate the Poisson disc differently for every pixel.
+float getWhiteNoise(vec2 pixel) {
+  return fract(sin(dot(pixel, vec2(12.9898, 78.233))) * 43758.5453);
+}
+
+// Interleaved gradient noise in [0,1). Its energy is mostly high-frequency (like blue noise), so the banding from a low tap count turns into fine grain instead of blotches.
+float getBlueNoise(vec2 pixel) {
+  return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+// Golden angle spiral, which spreads any number of taps evenly over the unit disc.
+vec2 getSpiralTap(int index, int tapCount, float rotation) {
+  const float goldenAngle = 2.39996323;
+  float radius = sqrt((index + 0.5) / tapCount);
+  float angle = index * goldenAngle + rotation;
+  return radius * vec2(cos(angle), sin(angle));
+}
+
+// The weights of the pair of texels covered by a gather along one axis. Only the first and last texels of the kernel's footprint are partly covered.
+vec2 getGatherWeights(int gatherIndex, int kernelSize, float fraction) {
+  return vec2(gatherIndex == 0 ? 1 - fraction : 1, gatherIndex == kernelSize ? fraction : 1);
+}
+
+// Returns the fraction of the filter kernel that is lit, using the filter mode from the config.
+float getLitFraction(int shadowMapIndex, vec2 centreTexCoord, float referenceDepth, float texelSize) {
+  const int kernelSize = SHADOW_ANTI_ALIAS_SIZE;
+  
+  // A single fetch is already bilinearly filtered by the comparison sampler.
+  if (kernelSize == 0) return texture(shadowMaps, vec4(centreTexCoord, shadowMapIndex, referenceDepth));
+  
+  const float kernelRadius = kernelSize * texelSize;
+  float litSum = 0;
+  int fetchCount = 0;
+  
+  switch (config.shadowFilterMode) {
+    case POISSON_PCF: {
+      // Rotating the disc per pixel trades banding for noise
+      const float angle = getWhiteNoise(gl_FragCoord.xy + shadowMapIndex) * TAU;
+      const mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+      
+      for (int i = 0; i < config.shadowFilterTapCount; i++) {
+        const vec2 texCoord = centreTexCoord + rotation * poissonDisc[i] * kernelRadius;
+        litSum += texture(shadowMaps, vec4(texCoord, shadowMapIndex, referenceDepth));
+      }
+      
+      fetchCount = config.shadowFilterTapCount;
+      break;
+    }
+    
+    case BLUE_NOISE_PCF: {
+      const float rotation = getBlueNoise(gl_FragCoord.xy + shadowMapIndex * 5.588238) * TAU;
+      
+      for (int i = 0; i < config.shadowFilterTapCount; i++) {
+        const vec2 texCoord = centreTexCoord + getSpiralTap(i, config.shadowFilterTapCount, rotation) * kernelRadius;
+        litSum += texture(shadowMaps, vec4(texCoord, shadowMapIndex, referenceDepth));
+      }
+      
+      fetchCount = config.shadowFilterTapCount;
+      break;
+    }
+    
+    case GATHER_PCF: {
+      // SQUARE_PCF's bilinear taps together cover 2 * kernelSize + 2 texels along each axis, with the outermost texels only partly weighted. Each gather returns the comparison results of a 2x2 block of those texels, which are weighted so the result matches SQUARE_PCF.
+      const vec2 texelCoord = centreTexCoord / texelSize - 0.5;
+      const vec2 firstTexel = floor(texelCoord) - kernelSize;
+      const vec2 fraction = texelCoord - floor(texelCoord);
+      
+      for (int x = 0; x <= kernelSize; x++) {
+        const vec2 xWeights = getGatherWeights(x, kernelSize, fraction.x);
+        
+        for (int y = 0; y <= kernelSize; y++) {
+          const vec2 yWeights = getGatherWeights(y, kernelSize, fraction.y);
+          
+          // The corner shared by the block's four texels
+          const vec2 texCoord = (firstTexel + vec2(x, y) * 2 + 1) * texelSize;
+          const vec4 litTexels = textureGather(shadowMaps, vec3(texCoord, shadowMapIndex), referenceDepth);
+          
+          // Gathered components are ordered (u0, v1), (u1, v1), (u1, v0), (u0, v0)
+          litSum += dot(litTexels, vec4(xWeights.x * yWeights.y, xWeights.y * yWeights.y, xWeights.y * yWeights.x, xWeights.x * yWeights.x));
+        }
+      }
+      
+      // The weights add up to the square kernel's tap count
+      return litSum / ((2 * kernelSize + 1) * (2 * kernelSize + 1));
+    }
+    
+    default: {
+      // Take samples from a square from a kernel.
+      for (int x = -kernelSize; x <= kernelSize; x++) {
+        for (int y = -kernelSize; y <= kernelSize; y++) {
+          const vec2 texCoord = centreTexCoord + vec2(x, y) * texelSize;
+          litSum += texture(shadowMaps, vec4(texCoord, shadowMapIndex, referenceDepth));
+          fetchCount++;
+        }
+      }
+      break;
+    }
+  }
+  
+  return litSum / fetchCount;
+}
+
+// Converts a depth from the light's projection back into a distance along the light's view direction.
+float getLightViewDistance(float depth) {
+  return lightMatrices.proj[3][2] / (depth + lightMatrices.proj[2][2]);
+}
+
+// Caps the PCSS blocker search and filter radii (in shadowmap UV units), as the search region grows without bound for receivers far from the light.
+const float MAX_PCSS_RADIUS = 0.05;
+
+// Percentage-closer soft shadows. The blockers around this point are found in the shadowmap, and their average distance gives the penumbra width by similar triangles. The comparison filter is then scaled to that width.
+float getPcssLitFraction(int shadowMapIndex, vec2 centreTexCoord, float referenceDepth, float receiverDistance) {
+  const float nearDistance = getLightViewDistance(0);
+  const int tapCount = config.shadowFilterTapCount;
+  const float rotation = getBlueNoise(gl_FragCoord.xy) * TAU;
+  
+  // A world-space width at distance d from the light covers this many UV units, divided by d.
+  const float uvScale = abs(lightMatrices.proj[0][0]) * 0.5;
+  
+  // Blockers that can hide part of the light lie in the cone between this point and the light's disc, which is widest at the near plane.
+  const float searchRadius = min(config.lightRadius * uvScale * (receiverDistance - nearDistance) / (receiverDistance * nearDistance), MAX_PCSS_RADIUS);
+  
+  float blockerDistanceSum = 0;
+  int blockerCount = 0;
+  
+  for (int i = 0; i < tapCount; i++) {
+    const vec2 texCoord = centreTexCoord + getSpiralTap(i, tapCount, rotation) * searchRadius;
+    const float depth = texture(shadowDepths, vec3(texCoord, shadowMapIndex)).r;
+    
+    if (depth < referenceDepth) {
+      blockerDistanceSum += getLightViewDistance(depth);
+      blockerCount++;
+    }
+  }
+  
+  if (blockerCount == 0) return 1;
+  
+  const float blockerDistance = blockerDistanceSum / blockerCount;
+  const float penumbraWidth = config.lightRadius * (receiverDistance - blockerDistance) / blockerDistance;
+  const float filterRadius = min(penumbraWidth * uvScale / receiverDistance, MAX_PCSS_RADIUS);
+  
+  float litSum = 0;
+  
+  for (int i = 0; i < tapCount; i++) {
+    const vec2 texCoord = centreTexCoord + getSpiralTap(i, tapCount, rotation) * filterRadius;
+    litSum += texture(shadowMaps, vec4(texCoord, shadowMapIndex, referenceDepth));
+  }
+  
+  return litSum / tapCount;
+}
+
+// This must match shadowMoments.frag
+const float ESM_EXPONENT = 40.0;
+
+// Below this variance, VSM would treat slightly uneven surfaces as occluders.
+const float VSM_MIN_VARIANCE = 0.000002;
+
+// VSM lit fractions below this are treated as fully shadowed, which hides most light bleeding where occluders overlap.
+const float VSM_LIGHT_BLEED_REDUCTION = 0.2;
+
+// VSM and ESM: a single filtered fetch of the pre-blurred moments replaces the PCF kernel.
+float getMomentsLitFraction(int shadowMapIndex, vec2 centreTexCoord, float receiverDistance) {
+  const vec2 moments = texture(shadowMoments, vec3(centreTexCoord, shadowMapIndex)).rg;
+  const float distance = min(receiverDistance / config.momentsDistanceRange, 1.0);
+  
+  if (config.shadowFilterMode == ESM) {
+    return clamp(moments.x * exp(-ESM_EXPONENT * (distance - 1)), 0, 1);
+  }
+  
+  if (distance <= moments.x) return 1;
+  
+  // Chebyshev's upper bound on the fraction of the filter region that is at least this far away
+  const float variance = max(moments.y - moments.x * moments.x, VSM_MIN_VARIANCE);
+  const float difference = distance - moments.x;
+  const float litFraction = variance / (variance + difference * difference);
+  
+  return clamp((litFraction - VSM_LIGHT_BLEED_REDUCTION) / (1 - VSM_LIGHT_BLEED_REDUCTION), 0, 1);
+}
+
+// Returns the degree to which a world position is shadowed.
+// 0 for no shadow, 1 for completely shadowed.
+float getShadowFactorFromMap(int shadowMapIndex) {
+  vec3 posWithOffset = surfacePosInLightView;
+  mat4 layerProj = shadowLayers.cascadeProjections[shadowMapIndex];
+  
+  if (!shadowLayers.cascades) {
+    posWithOffset.xy += shadowLayers.offsets[shadowMapIndex];
+    layerProj = lightMatrices.proj;
+  }
+  
+  float texelSize = 1.0 / textureSize(shadowMaps, 0).x;
+  
+  const vec4 posInLightProj = layerProj * vec4(posWithOffset, 1);
+  
+  // This is the perspective division that transforms projection space into normalised device space.
+  const vec3 normalisedDevicePos = posInLightProj.xyz / posInLightProj.w;
+  
+  // Change the bounds from [-1,1] to [0,1].
+  vec2 centreTexCoord = normalisedDevicePos.xy * 0.5 + 0.5;
+  
+  // This is necessary due to floating point inaccuracy. The reference depth is taken from a point a tenth of a millimeter closer to the light (the origin of light view space, or up its +Z axis for directional lights), so it's not noticeable.
+  const float epsilon = 0.0001;
+  const vec3 towardsLight = shadowLayers.cascades ? vec3(0, 0, 1) : -normalize(posWithOffset);
+  const vec3 biasedPos = posWithOffset + towardsLight * epsilon;
+  const vec4 biasedPosInLightProj = layerProj * vec4(biasedPos, 1);
+  const float referenceDepth = biasedPosInLightProj.z / biasedPosInLightProj.w;
+  
+  // The light looks down its view space's -Z axis
+  const float receiverDistance = -posWithOffset.z;
+  
+  // VSM, ESM and PCSS work in the point light's perspective depth, so cascades always use PCF.
+  if (shadowLayers.cascades) {
+    return 1 - getLitFraction(shadowMapIndex, centreTexCoord, referenceDepth, texelSize);
+  }
+  
+  if (config.shadowFilterMode == VSM || config.shadowFilterMode == ESM) {
+    return 1 - getMomentsLitFraction(shadowMapIndex, centreTexCoord, receiverDistance);
+  }
+  
+  if (config.pcss) {
+    return 1 - getPcssLitFraction(shadowMapIndex, centreTexCoord, referenceDepth, receiverDistance);
+  }
+  
+  return 1 - getLitFraction(shadowMapIndex, centreTexCoord, referenceDepth, texelSize);
+}
+
+// Picks the first cascade that reaches past this point's distance from the camera.
+int getCascadeIndex() {
+  const float cameraDistance = -surfacePos.z;
+  
+  const int lastCascade = shadowLayers.cascadeProjections.length() - 1;
+  
+  for (int i = 0; i < lastCascade; i++) {
+    if (cameraDistance < shadowLayers.cascadeSplits[i]) return i;
+  }
+  
+  return lastCascade;
+}
+
+float getTotalShadowFactor() {
+  if (shadowLayers.cascades) return getShadowFactorFromMap(getCascadeIndex());
+  
+  float totalFactor = 0;
+  
+  for (int i = 0; i < SHADOW_MAP_COUNT; i++) {
+    totalFactor += getShadowFactorFromMap(i);
+  }
+  
+  return totalFactor / SHADOW_MAP_COUNT;
+}
+
+// Phong lighting from the point light, with the diffuse and specular terms darkened by the shadow.
+vec3 getLitColor(vec3 color, vec3 surfaceNormal, float diffuseReflectionConst, float specReflectionConst, float specPowerConst) {
+  const vec3 viewPos = vec3(0, 0, 0); // This is the origin because we are in view-space
+  
+  const vec3 surfaceToLightDirectionUnit = normalize(lightPos - surfacePos);
+  const vec3 surfaceToViewDirectionUnit = normalize(viewPos - surfacePos);
+  const vec3 reflectionDirectionUnit = reflect(-surfaceToLightDirectionUnit, surfaceNormal);
+  
+  float surfaceNormalLightDirDot = dot(surfaceNormal, surfaceToLightDirectionUnit);
+  
+  float diffuseReflection = 0;
+  float specReflection = 0;
+  
+  if (surfaceNormalLightDirDot > 0) {
+    diffuseReflection = diffuseReflectionConst * surfaceNormalLightDirDot;
+    
+    float reflectionViewDot = dot(reflectionDirectionUnit, surfaceToViewDirectionUnit);
+    
+    if (reflectionViewDot > 0) {
+      specReflection = specReflectionConst * pow(reflectionViewDot, specPowerConst);
+    }
+  }
+  
+  float shadowFactor = getTotalShadowFactor();
+  diffuseReflection *= 1 - shadowFactor;
+  specReflection *= 1 - shadowFactor;
+  
+  const float colorReflection = config.ambReflection + diffuseReflection;
+  
+  return color * colorReflection + specReflection;
+}
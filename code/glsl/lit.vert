@@ -1,7 +1,7 @@
 #version 450
 
 layout(location = 0) in vec3 vertPosInMesh;
-layout(location = 1) in vec3 vertNormalInMesh;
+layout(location = 1) in vec2 vertNormalInMeshOctahedral;
 
 layout(location = 0) out vec3 vertPosInView;
 layout(location = 1) out vec3 vertNormalInView;
@@ -10,6 +10,8 @@ layout(location = 3) out vec3 vertPosInLightView;
 
 layout(set = 0, binding = 0) uniform DrawCall {
   mat4 worldMatrix;
+  vec4 positionScale;
+  vec4 positionOffset;
   float diffuseReflectionConst;
   float specReflectionConst;
   int specPowerConst;
@@ -25,8 +27,28 @@ layout(set = 2, binding = 0) uniform Matrices {
   mat4 proj;
 } matrices;
 
+// The depth pre-pass (depthPrePass.vert) must produce bit-identical depths for the EQUAL depth test here
+invariant gl_Position;
+
+// Positions may be quantized to the mesh's bounds (see QUANTIZE_VERTEX_POSITIONS)
+vec3 getPositionInMesh() {
+  return vertPosInMesh * drawCall.positionScale.xyz + drawCall.positionOffset.xyz;
+}
+
+// Inverse of encodeOctahedralNormal() in DrawCall.cpp
+vec3 decodeOctahedralNormal(vec2 encoded) {
+  vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  
+  if (normal.z < 0) {
+    vec2 signs = vec2(normal.x >= 0 ? 1 : -1, normal.y >= 0 ? 1 : -1);
+    normal.xy = (1.0 - abs(normal.yx)) * signs;
+  }
+  
+  return normalize(normal);
+}
+
 void main() {
-  vec4 vertPosInWorld4 = drawCall.worldMatrix * vec4(vertPosInMesh, 1.0);
+  vec4 vertPosInWorld4 = drawCall.worldMatrix * vec4(getPositionInMesh(), 1.0);
   vec4 vertPosInView4 = matrices.view * vertPosInWorld4;
   vertPosInView = vertPosInView4.xyz;
   
@@ -37,7 +59,7 @@ void main() {
   // Transform the normal to view space
   mat3 normalMatrix = mat3(matrices.view * drawCall.worldMatrix);
   normalMatrix = transpose(inverse(normalMatrix));
-  vertNormalInView = normalMatrix * vertNormalInMesh;
+  vertNormalInView = normalMatrix * decodeOctahedralNormal(vertNormalInMeshOctahedral);
   
   // The light is of course at the origin in light-view space, so we can get its world position this way:
   vec4 lightPosInWorld4 = inverse(lightMatrices.view) * vec4(0, 0, 0, /* <- origin */ 1);
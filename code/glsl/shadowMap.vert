@@ -1,12 +1,11 @@
 #version 450
 
 layout(location = 0) in vec3 vertPos;
-layout(location = 1) in vec3 normal;
-
-layout(location = 0) out vec4 vertPosInView;
 
 layout(set = 0, binding = 0) uniform DrawCall {
   mat4 worldMatrix;
+  vec4 positionScale;
+  vec4 positionOffset;
 } drawCall;
 
 layout(set = 1, binding = 0) uniform Matrices {
@@ -14,15 +13,29 @@ layout(set = 1, binding = 0) uniform Matrices {
   mat4 proj;
 } matrices;
 
-layout(push_constant) uniform ViewOffset {
-  vec2 value;
-} viewOffset;
+layout(set = 2, binding = 0) uniform ShadowLayers {
+  vec2 offsets[14]; // MAX_LIGHT_SUBSOURCE_COUNT
+  mat4 cascadeProjections[4]; // CASCADE_COUNT
+  vec4 cascadeSplits;
+  bool cascades;
+} shadowLayers;
 
-void main() {
-  vertPosInView = matrices.view * drawCall.worldMatrix * vec4(vertPos, 1.0);
-  vertPosInView.xy += viewOffset.value;
+// Point lights offset each subsource's view, while each cascade of a directional light has its own projection.
+vec4 getPositionInLayer(int layer) {
+  vec4 vertPosInView = matrices.view * drawCall.worldMatrix * vec4(vertPos * drawCall.positionScale.xyz + drawCall.positionOffset.xyz, 1.0);
   
-  gl_Position = matrices.proj * vertPosInView;
+  if (shadowLayers.cascades) return shadowLayers.cascadeProjections[layer] * vertPosInView;
+  
+  vertPosInView.xy += shadowLayers.offsets[layer];
+  return matrices.proj * vertPosInView;
+}
+
+layout(push_constant) uniform Config {
+  int layer;
+} config;
+
+void main() {
+  gl_Position = getPositionInLayer(config.layer);
 }
 
 
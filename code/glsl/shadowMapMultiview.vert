@@ -0,0 +1,37 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+layout(location = 0) in vec3 vertPos;
+
+layout(set = 0, binding = 0) uniform DrawCall {
+  mat4 worldMatrix;
+  vec4 positionScale;
+  vec4 positionOffset;
+} drawCall;
+
+layout(set = 1, binding = 0) uniform Matrices {
+  mat4 view;
+  mat4 proj;
+} matrices;
+
+layout(set = 2, binding = 0) uniform ShadowLayers {
+  vec2 offsets[14]; // MAX_LIGHT_SUBSOURCE_COUNT
+  mat4 cascadeProjections[4]; // CASCADE_COUNT
+  vec4 cascadeSplits;
+  bool cascades;
+} shadowLayers;
+
+// Point lights offset each subsource's view, while each cascade of a directional light has its own projection.
+vec4 getPositionInLayer(int layer) {
+  vec4 vertPosInView = matrices.view * drawCall.worldMatrix * vec4(vertPos * drawCall.positionScale.xyz + drawCall.positionOffset.xyz, 1.0);
+  
+  if (shadowLayers.cascades) return shadowLayers.cascadeProjections[layer] * vertPosInView;
+  
+  vertPosInView.xy += shadowLayers.offsets[layer];
+  return matrices.proj * vertPosInView;
+}
+
+void main() {
+  // gl_ViewIndex is the shadow map layer being rendered to
+  gl_Position = getPositionInLayer(int(gl_ViewIndex));
+}
@@ -5,8 +5,16 @@ layout(location = 0) out vec4 outColor;
 
 layout(set = 1, binding = 0) uniform sampler2D shadowMap;
 
+// These must match the light projection in shadows.cpp.
+const float near = 0.1;
+const float far = 100.0;
+
 void main() {
-  // The color is shrunk by a factor of 0.04 in order to fit the distances contained in the shadowMap (which are usually >1) into unit range [0,1]. If we didn't do this, everything would appear white.
-  vec3 color3 = vec3(texture(shadowMap, texCoord).r * 0.04);
+  // Perspective depth is nearly 1 everywhere, so it's converted back into a linear distance first.
+  float depth = texture(shadowMap, texCoord).r;
+  float distance = near * far / (far - depth * (far - near));
+  
+  // The color is shrunk by a factor of 0.04 in order to fit the distances (which are usually >1) into unit range [0,1]. If we didn't do this, everything would appear white.
+  vec3 color3 = vec3(distance * 0.04);
   outColor = vec4(color3, 1);
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+#version 450
+
+layout(location = 0) out vec2 outMoments;
+
+layout(set = 0, binding = 0) uniform sampler2DArray shadowDepths;
+
+layout(push_constant) uniform Config {
+  int layer;
+  bool esm;
+  int blurRadius;
+  float projZScale;
+  float projZOffset;
+  float distanceRange; // The light's far plane distance
+} config;
+
+// This must match lighting.glsl. Distances are divided by the light's range to keep the moments (and the ESM exponential) in a well-behaved range.
+const float ESM_EXPONENT = 40.0;
+
+vec2 getMoments(float depth) {
+  // Convert the projected depth back into a distance along the light's view direction
+  float distance = min(config.projZOffset / (depth + config.projZScale) / config.distanceRange, 1.0);
+  
+  // The ESM value is shifted down by exp(ESM_EXPONENT) so that it never exceeds 1, which keeps it representable in 16-bit floats.
+  if (config.esm) return vec2(exp(ESM_EXPONENT * (distance - 1)), 0);
+  
+  return vec2(distance, distance * distance);
+}
+
+// Horizontal half of the separable box blur. The vertical half is in shadowMomentsBlur.frag.
+void main() {
+  ivec2 size = textureSize(shadowDepths, 0).xy;
+  ivec2 centre = ivec2(gl_FragCoord.xy);
+  vec2 sum = vec2(0);
+  
+  for (int x = -config.blurRadius; x <= config.blurRadius; x++) {
+    ivec2 texel = ivec2(clamp(centre.x + x, 0, size.x - 1), centre.y);
+    sum += getMoments(texelFetch(shadowDepths, ivec3(texel, config.layer), 0).r);
+  }
+  
+  outMoments = sum / (config.blurRadius * 2 + 1);
+}
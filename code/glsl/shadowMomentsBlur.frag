@@ -0,0 +1,28 @@
+#version 450
+
+layout(location = 0) out vec2 outMoments;
+
+layout(set = 0, binding = 0) uniform sampler2D moments;
+
+layout(push_constant) uniform Config {
+  int layer;
+  bool esm;
+  int blurRadius;
+  float projZScale;
+  float projZOffset;
+  float distanceRange;
+} config;
+
+// Vertical half of the separable box blur. The horizontal half is in shadowMoments.frag.
+void main() {
+  ivec2 size = textureSize(moments, 0);
+  ivec2 centre = ivec2(gl_FragCoord.xy);
+  vec2 sum = vec2(0);
+  
+  for (int y = -config.blurRadius; y <= config.blurRadius; y++) {
+    ivec2 texel = ivec2(centre.x, clamp(centre.y + y, 0, size.y - 1));
+    sum += texelFetch(moments, texel, 0).rg;
+  }
+  
+  outMoments = sum / (config.blurRadius * 2 + 1);
+}
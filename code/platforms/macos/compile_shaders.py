@@ -9,7 +9,8 @@ os.chdir(script_dir)
 glsl_dir = os.path.abspath('../../glsl')
 spirv_dir = os.path.abspath('../../assets')
 
-glsl_files = [file for file in os.listdir('../../glsl') if file[0] != '.']
+# .glsl files are only #included by the shaders, so they aren't compiled on their own
+glsl_files = [file for file in os.listdir('../../glsl') if file[0] != '.' and not file.endswith('.glsl')]
 
 for glsl_file in glsl_files:
   try:
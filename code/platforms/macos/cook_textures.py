@@ -0,0 +1,43 @@
+import os
+import sys
+import subprocess
+
+script_path = os.path.abspath(__file__)
+script_dir = os.path.dirname(script_path)
+os.chdir(script_dir)
+
+assets_dir = os.path.abspath('../../assets')
+cooker_source = os.path.abspath('../../tools/textureCooker.cpp')
+cooker = os.path.abspath('./textureCooker')
+
+try:
+  command = [
+    'clang++',
+    '-std=c++14',
+    '-O2',
+    '-I', os.path.abspath('../../libs/stb_image'),
+    '-F', script_dir,
+    cooker_source,
+    '-o',
+    cooker
+  ]
+  subprocess.check_output(command, stderr=subprocess.STDOUT, text=True)
+except subprocess.CalledProcessError as e:
+  print(e.output)
+  sys.exit(1)
+
+image_files = [file for file in os.listdir(assets_dir) if file[0] != '.' and file.endswith('.jpg')]
+
+for image_file in image_files:
+  try:
+    command = [
+      cooker,
+      os.path.join(assets_dir, image_file),
+      os.path.join(assets_dir, os.path.splitext(image_file)[0] + '.ktx2')
+    ]
+    if '_normals' in image_file:
+      command.append('--normal-map')
+    subprocess.check_output(command, stderr=subprocess.STDOUT, text=True)
+  except subprocess.CalledProcessError as e:
+    print(e.output)
+    sys.exit(1)
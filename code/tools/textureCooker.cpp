@@ -0,0 +1,322 @@
+// Texture cooker: converts the source images in assets/ into block-compressed mip chains that gfx::loadImage can upload without decoding.
+//
+// Usage: textureCooker <input image> <output .ktx2> [--normal-map]
+//
+// Colour images become BC1, or BC3 if they have any transparency. Normal maps are converted with cookedTexture::convertNormalMapTexel() and become two-channel BC5.
+
+#include "../cpp/cookedTexture.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// A mip level as floats: [0, 1] for colour, [-1, 1] for normal maps
+struct Level {
+  uint32_t width;
+  uint32_t height;
+  vector<float> texels; // RGBA
+  
+  const float * getTexel(uint32_t x, uint32_t y) const {
+    
+    // Blocks hanging off the edge of small levels repeat the edge texels
+    if (x >= width) x = width - 1;
+    if (y >= height) y = height - 1;
+    return &texels[(y * width + x) * 4];
+  }
+};
+
+static Level downsample(const Level &level) {
+  Level result;
+  result.width = level.width > 1 ? level.width / 2 : 1;
+  result.height = level.height > 1 ? level.height / 2 : 1;
+  result.texels.resize(result.width * result.height * 4);
+  
+  // 2x2 box filter
+  for (uint32_t y = 0; y < result.height; y++) {
+    for (uint32_t x = 0; x < result.width; x++) {
+      for (int c = 0; c < 4; c++) {
+        float sum = level.getTexel(x*2, y*2)[c] + level.getTexel(x*2+1, y*2)[c] + level.getTexel(x*2, y*2+1)[c] + level.getTexel(x*2+1, y*2+1)[c];
+        result.texels[(y * result.width + x) * 4 + c] = sum / 4;
+      }
+    }
+  }
+  
+  return result;
+}
+
+static float clamp(float value, float low, float high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+static uint16_t packRGB565(const float *rgb) {
+  uint16_t r = (uint16_t)(clamp(rgb[0], 0, 1) * 31 + 0.5f);
+  uint16_t g = (uint16_t)(clamp(rgb[1], 0, 1) * 63 + 0.5f);
+  uint16_t b = (uint16_t)(clamp(rgb[2], 0, 1) * 31 + 0.5f);
+  return (r << 11) | (g << 5) | b;
+}
+
+static void unpackRGB565(uint16_t packed, float *rgbOut) {
+  rgbOut[0] = ((packed >> 11) & 31) / 31.0f;
+  rgbOut[1] = ((packed >> 5) & 63) / 63.0f;
+  rgbOut[2] = (packed & 31) / 31.0f;
+}
+
+// BC1 colour block in 4-colour mode. The endpoints are the extremes of the block's colours along their principal axis, pulled in slightly to reduce the error of the interpolated colours.
+static void encodeBC1(const float block[16][4], uint8_t *out) {
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) for (int c = 0; c < 3; c++) mean[c] += block[i][c] / 16;
+  
+  float covariance[6] = {0, 0, 0, 0, 0, 0}; // rr, rg, rb, gg, gb, bb
+  for (int i = 0; i < 16; i++) {
+    float r = block[i][0] - mean[0], g = block[i][1] - mean[1], b = block[i][2] - mean[2];
+    covariance[0] += r*r; covariance[1] += r*g; covariance[2] += r*b;
+    covariance[3] += g*g; covariance[4] += g*b; covariance[5] += b*b;
+  }
+  
+  // Power iteration for the principal axis
+  float axis[3] = {1, 1, 1};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3] = {
+      covariance[0]*axis[0] + covariance[1]*axis[1] + covariance[2]*axis[2],
+      covariance[1]*axis[0] + covariance[3]*axis[1] + covariance[4]*axis[2],
+      covariance[2]*axis[0] + covariance[4]*axis[1] + covariance[5]*axis[2],
+    };
+    float length = sqrtf(next[0]*next[0] + next[1]*next[1] + next[2]*next[2]);
+    if (length < 1e-8f) break;
+    for (int c = 0; c < 3; c++) axis[c] = next[c] / length;
+  }
+  
+  float minProjection = 1e9f, maxProjection = -1e9f;
+  for (int i = 0; i < 16; i++) {
+    float projection = (block[i][0] - mean[0])*axis[0] + (block[i][1] - mean[1])*axis[1] + (block[i][2] - mean[2])*axis[2];
+    if (projection < minProjection) minProjection = projection;
+    if (projection > maxProjection) maxProjection = projection;
+  }
+  
+  float inset = (maxProjection - minProjection) / 16;
+  float endpoint0[3], endpoint1[3];
+  for (int c = 0; c < 3; c++) {
+    endpoint0[c] = mean[c] + axis[c] * (maxProjection - inset);
+    endpoint1[c] = mean[c] + axis[c] * (minProjection + inset);
+  }
+  
+  uint16_t color0 = packRGB565(endpoint0);
+  uint16_t color1 = packRGB565(endpoint1);
+  
+  // color0 > color1 selects 4-colour mode
+  if (color0 < color1) {
+    uint16_t swap = color0;
+    color0 = color1;
+    color1 = swap;
+  }
+  
+  float palette[4][3];
+  unpackRGB565(color0, palette[0]);
+  unpackRGB565(color1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+  }
+  
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    for (int i = 0; i < 16; i++) {
+      int bestIndex = 0;
+      float bestError = 1e9f;
+      for (int p = 0; p < 4; p++) {
+        float dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+        float error = dr*dr + dg*dg + db*db;
+        if (error < bestError) {
+          bestError = error;
+          bestIndex = p;
+        }
+      }
+      indices |= bestIndex << (i*2);
+    }
+  }
+  
+  memcpy(out, &color0, 2);
+  memcpy(out + 2, &color1, 2);
+  memcpy(out + 4, &indices, 4);
+}
+
+// BC4 single-channel block in 8-value mode, used for BC3 alpha and both BC5 channels. Signed blocks store endpoints in [-127, 127].
+static void encodeBC4(const float block[16][4], int channel, bool isSigned, uint8_t *out) {
+  float low = 1e9f, high = -1e9f;
+  for (int i = 0; i < 16; i++) {
+    if (block[i][channel] < low) low = block[i][channel];
+    if (block[i][channel] > high) high = block[i][channel];
+  }
+  
+  float scale = isSigned ? 127 : 255;
+  float minValue = isSigned ? -1 : 0;
+  int endpoint0 = (int)roundf(clamp(high, minValue, 1) * scale);
+  int endpoint1 = (int)roundf(clamp(low, minValue, 1) * scale);
+  
+  // endpoint0 > endpoint1 selects 8-value mode
+  if (endpoint0 == endpoint1) {
+    if (endpoint0 > (isSigned ? -127 : 0)) endpoint1--;
+    else endpoint0++;
+  }
+  
+  float palette[8];
+  palette[0] = endpoint0 / scale;
+  palette[1] = endpoint1 / scale;
+  for (int p = 1; p < 7; p++) palette[p+1] = ((7-p) * palette[0] + p * palette[1]) / 7;
+  
+  uint64_t indices = 0;
+  for (int i = 0; i < 16; i++) {
+    int bestIndex = 0;
+    float bestError = 1e9f;
+    for (int p = 0; p < 8; p++) {
+      float error = fabsf(block[i][channel] - palette[p]);
+      if (error < bestError) {
+        bestError = error;
+        bestIndex = p;
+      }
+    }
+    indices |= (uint64_t)bestIndex << (i*3);
+  }
+  
+  // Signed endpoints are stored as two's complement bytes
+  out[0] = (uint8_t)endpoint0;
+  out[1] = (uint8_t)endpoint1;
+  for (int b = 0; b < 6; b++) out[2+b] = (uint8_t)(indices >> (b*8));
+}
+
+static vector<uint8_t> encodeLevel(const Level &level, VkFormat format) {
+  uint32_t blocksWide = (level.width + 3) / 4;
+  uint32_t blocksHigh = (level.height + 3) / 4;
+  uint32_t bytesPerBlock = cookedTexture::getBytesPerBlock(format);
+  vector<uint8_t> data(blocksWide * blocksHigh * bytesPerBlock);
+  
+  for (uint32_t by = 0; by < blocksHigh; by++) {
+    for (uint32_t bx = 0; bx < blocksWide; bx++) {
+      float block[16][4];
+      for (int i = 0; i < 16; i++) memcpy(block[i], level.getTexel(bx*4 + i%4, by*4 + i/4), sizeof(block[i]));
+      
+      uint8_t *out = &data[(by * blocksWide + bx) * bytesPerBlock];
+      
+      switch (format) {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+          encodeBC1(block, out);
+          break;
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+          encodeBC4(block, 3, false, out);
+          encodeBC1(block, out + 8);
+          break;
+        case VK_FORMAT_BC5_SNORM_BLOCK:
+          encodeBC4(block, 0, true, out);
+          encodeBC4(block, 1, true, out + 8);
+          break;
+        default: break;
+      }
+    }
+  }
+  
+  return data;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("Usage: textureCooker <input image> <output .ktx2> [--normal-map]\n");
+    return 1;
+  }
+  
+  const char *inputPath = argv[1];
+  const char *outputPath = argv[2];
+  bool normalMap = argc > 3 && strcmp(argv[3], "--normal-map") == 0;
+  
+  int width, height, componentsPerPixel;
+  uint8_t *pixels = stbi_load(inputPath, &width, &height, &componentsPerPixel, 4);
+  if (pixels == nullptr) {
+    printf("Couldn't load %s: %s\n", inputPath, stbi_failure_reason());
+    return 1;
+  }
+  
+  Level level;
+  level.width = width;
+  level.height = height;
+  level.texels.resize(width * height * 4);
+  
+  bool transparent = false;
+  for (uint32_t i = 0; i < (uint32_t)(width * height * 4); i += 4) {
+    if (normalMap) {
+      
+      // Same conversion as the runtime path, then to signed floats
+      cookedTexture::convertNormalMapTexel(&pixels[i]);
+      for (int c = 0; c < 4; c++) level.texels[i+c] = (int8_t)pixels[i+c] / 127.0f;
+    } else {
+      for (int c = 0; c < 4; c++) level.texels[i+c] = pixels[i+c] / 255.0f;
+      if (pixels[i+3] < 255) transparent = true;
+    }
+  }
+  
+  stbi_image_free(pixels);
+  
+  VkFormat format = normalMap ? VK_FORMAT_BC5_SNORM_BLOCK : (transparent ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+  
+  // Encode the full mip chain
+  vector<vector<uint8_t>> encodedLevels;
+  while (true) {
+    encodedLevels.push_back(encodeLevel(level, format));
+    if (level.width == 1 && level.height == 1) break;
+    level = downsample(level);
+    
+    // Keep normal map texels unit length after filtering
+    if (normalMap) {
+      for (uint32_t i = 0; i < level.texels.size(); i += 4) {
+        float x = level.texels[i], z = level.texels[i+1];
+        float length = sqrtf(x*x + z*z);
+        if (length > 1) {
+          level.texels[i] = x / length;
+          level.texels[i+1] = z / length;
+        }
+      }
+    }
+  }
+  
+  cookedTexture::Header header = {};
+  memcpy(header.identifier, cookedTexture::identifier, sizeof(header.identifier));
+  header.vkFormat = format;
+  header.typeSize = 1;
+  header.pixelWidth = width;
+  header.pixelHeight = height;
+  header.faceCount = 1;
+  header.levelCount = (uint32_t)encodedLevels.size();
+  
+  // As in KTX2, level data is stored smallest level first, each level aligned to its block size
+  vector<cookedTexture::LevelIndex> levelIndices(encodedLevels.size());
+  uint64_t offset = sizeof(header) + levelIndices.size() * sizeof(levelIndices[0]);
+  uint32_t alignment = cookedTexture::getBytesPerBlock(format);
+  
+  for (int i = (int)encodedLevels.size()-1; i >= 0; i--) {
+    offset = (offset + alignment - 1) / alignment * alignment;
+    levelIndices[i].byteOffset = offset;
+    levelIndices[i].byteLength = encodedLevels[i].size();
+    levelIndices[i].uncompressedByteLength = encodedLevels[i].size();
+    offset += encodedLevels[i].size();
+  }
+  
+  FILE *file = fopen(outputPath, "wb");
+  if (file == nullptr) {
+    printf("Couldn't write %s\n", outputPath);
+    return 1;
+  }
+  
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(levelIndices.data(), sizeof(levelIndices[0]), levelIndices.size(), file);
+  
+  for (int i = (int)encodedLevels.size()-1; i >= 0; i--) {
+    while ((uint64_t)ftell(file) < levelIndices[i].byteOffset) fputc(0, file);
+    fwrite(encodedLevels[i].data(), 1, encodedLevels[i].size(), file);
+  }
+  
+  fclose(file);
+  
+  printf("Cooked %s -> %s (%ix%i, %i levels, %s)\n", inputPath, outputPath, width, height, header.levelCount, normalMap ? "BC5" : (transparent ? "BC3" : "BC1"));
+  return 0;
+}